@@ -13,18 +13,22 @@
 //
 
 #include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <type_traits>
+#include <utility>
 
 #ifndef btree_h
 #define btree_h
 
-// The BTREE_ORDER definition sets the B-tree order (using the Knuth
-// definition). This is the number of children the node can have. The
-// number of keys is one less than this value.
-#define BTREE_ORDER 5
-#define MAX_KEYS 4
-#define MIN_KEYS 2
+#include "btree_arena.h"
+#include "btree_search.h"
+#include "btree_summary.h"
 
 #define LOG_INFO(msg) std::cout << "[INFO] " << msg << std::endl;
 #define LOG_ERROR(msg) std::cerr << "[ERROR] " << msg << std::endl;
@@ -37,62 +41,723 @@ using namespace std;
 // slots if you don't want to. Don't take this as a subtle hint that I
 // want you to do it this way.
 //
+// Order sets the B-tree order (using the Knuth definition). This is
+// the number of children the node can have. The number of keys is one
+// less than this value. Pick it so a node fills a cache line or a page
+// to keep the tree shallow; 5 is small enough to draw by hand.
+//
 // A valid btree node can have at most:
-//   BTREE_ORDER-1 keys.
-//   BTREE_ORDER children.
-struct btree {
+//   max_keys (Order-1) keys.
+//   Order children.
+// and, unless it is the root, at least min_keys (ceil(Order/2)-1) keys.
+//
+// btree is the part every node shares. A node is really either a
+// btree_leaf or a btree_internal (below), and is_leaf says which, so
+// leaves - most of the nodes in a tree - don't carry a children array
+// they never use. Code that walks the tree works on btree pointers and
+// uses child() to step down from an internal node.
+//
+// Search is the in-node search policy (see btree_search.h). The
+// default searches the sorted keys; sampled_search and
+// eytzinger_search keep an index next to them that makes searching a
+// large node cheaper, at the cost of rebuilding it on every change.
+//
+// Value makes the tree a map: each key gets a value, stored next to it
+// in the node (internal nodes hold keys too, so they hold values as
+// well). It defaults to void, a plain set of keys, which stores
+// nothing extra. Values are only ever moved, never copied, so they may
+// be move-only; they need a default constructor. See btree_map below.
+//
+// BPlus makes the tree a B+ tree: every key (and value) lives in a
+// leaf, internal nodes hold only separator keys that route searches,
+// and the leaves are chained together in key order (see next_leaf), so
+// walking a range of keys is a walk along the chain rather than up and
+// down the tree. A separator is a copy of the first key of the subtree
+// to its right at the time it was made; it may outlive that key, but
+// it always sits between the subtrees on either side of it. See
+// bplus_ptr below.
+//
+// Summary keeps a summary of each child's subtree next to the child
+// pointer in internal nodes (see btree_summary.h). subtree_counts
+// makes rank and select O(log n); monoid_summary does the same for
+// aggregates over a range of keys.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+struct btree_internal;
+
+// node_values holds a map node's values; values[i] goes with keys[i].
+template <typename Value, int Order> struct node_values {
+  array<Value, Order> values;
+};
+
+// A set's nodes have no values.
+template <int Order> struct node_values<void, Order> {};
+
+// child_summaries holds an internal node's subtree summaries;
+// summaries[i] sums up the subtree under children[i].
+template <typename Summary, int Order> struct child_summaries {
+  array<typename Summary::type, Order + 1> summaries{};
+};
+
+// Without a summary policy there is nothing to hold.
+template <int Order> struct child_summaries<no_summary, Order> {};
+
+// node_limits holds how many keys a node of the given order may have.
+// Every node type (btree's here, and the concurrent, B-link and
+// persistent trees') takes them from it.
+template <int Order> struct node_limits {
+  static_assert(Order >= 3, "a btree node needs room for at least 3 children");
+
+  static constexpr int order = Order;
+  static constexpr int max_keys = Order - 1;
+  static constexpr int min_keys = (Order + 1) / 2 - 1;
+};
+
+template <typename Key = int, int Order = 5, typename Search = sorted_search,
+          typename Value = void, bool BPlus = false,
+          typename Summary = no_summary>
+struct btree : node_values<Value, Order>, node_limits<Order> {
+  using key_type = Key;
+  using mapped_type = Value;
+  using search_type = Search;
+  using summary_type = Summary;
+
+  static constexpr bool is_map = !is_void<Value>::value;
+  static constexpr bool is_bplus = BPlus;
+  static constexpr bool is_summarized = !is_same<Summary, no_summary>::value;
+
   // num_keys is the number of in keys array that are currently valid.
   int num_keys;
 
+  // is_leaf is true if this is a btree_leaf, false if it is a
+  // btree_internal. It is fixed when the node is allocated.
+  bool is_leaf;
+
+  // index is whatever the search policy keeps alongside keys. It is
+  // rebuilt every time keys change.
+  typename Search::template node_index<Key, Order> index;
+
   // keys is an array of values. valid indexes are in [0..num_keys)
-  array<int, BTREE_ORDER> keys;
+  array<Key, Order> keys;
 
-  // is_leaf is true if this is a leaf, false otherwise
-  bool is_leaf;
+  // child returns the i-th child of an internal node. Don't call it on
+  // a leaf.
+  btree *&child(int i);
+
+  // summary returns the summary of the i-th child's subtree, in a tree
+  // with a summary policy. Don't call it on a leaf.
+  auto &summary(int i);
+
+  // In a B+ tree, next_leaf and prev_leaf are the leaves after and
+  // before this one in key order, or nullptr at either end of the
+  // chain. Only call them on a leaf of a B+ tree.
+  btree *&next_leaf();
+  btree *&prev_leaf();
+
+protected:
+  explicit btree(bool leaf) : num_keys(0), is_leaf(leaf), index() {
+    keys.fill(Key());
+  }
+};
+
+// leaf_links holds a B+ tree leaf's place in the leaf chain. Leaves of
+// other trees aren't chained, and carry nothing.
+template <typename Node, bool Linked> struct leaf_links {};
+
+template <typename Node> struct leaf_links<Node, true> {
+  Node *prev = nullptr;
+  Node *next = nullptr;
+};
+
+// btree_leaf is a node at the bottom of the tree. It holds only keys
+// (and values, in a map), and in a B+ tree its links to its neighbours.
+template <typename Key = int, int Order = 5, typename Search = sorted_search,
+          typename Value = void, bool BPlus = false,
+          typename Summary = no_summary>
+struct btree_leaf
+    : btree<Key, Order, Search, Value, BPlus, Summary>,
+      leaf_links<btree<Key, Order, Search, Value, BPlus, Summary>, BPlus> {
+  btree_leaf() : btree<Key, Order, Search, Value, BPlus, Summary>(true) {}
+};
+
+// btree_internal is a node with children, and with a summary policy,
+// their summaries.
+template <typename Key = int, int Order = 5, typename Search = sorted_search,
+          typename Value = void, bool BPlus = false,
+          typename Summary = no_summary>
+struct btree_internal : btree<Key, Order, Search, Value, BPlus, Summary>,
+                        child_summaries<Summary, Order> {
+  using node = btree<Key, Order, Search, Value, BPlus, Summary>;
 
   // children is an array of pointers to b-tree subtrees. valid
-  // indexes are in [0..num_keys].
-  array<shared_ptr<btree>, BTREE_ORDER+1> children;
+  // indexes are in [0..num_keys]. The nodes themselves are owned by
+  // the arenas of the btree_ptr the tree belongs to.
+  array<node *, Order + 1> children;
+
+  btree_internal() : node(false) { children.fill(nullptr); }
+};
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+btree<Key, Order, Search, Value, BPlus, Summary> *&
+btree<Key, Order, Search, Value, BPlus, Summary>::child(int i) {
+  using internal = btree_internal<Key, Order, Search, Value, BPlus, Summary>;
+  return static_cast<internal *>(this)->children[i];
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+auto &btree<Key, Order, Search, Value, BPlus, Summary>::summary(int i) {
+  static_assert(is_summarized, "the tree keeps no summaries");
+  using internal = btree_internal<Key, Order, Search, Value, BPlus, Summary>;
+  return static_cast<internal *>(this)->summaries[i];
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+btree<Key, Order, Search, Value, BPlus, Summary> *&
+btree<Key, Order, Search, Value, BPlus, Summary>::next_leaf() {
+  static_assert(BPlus, "only B+ tree leaves are chained");
+  using leaf = btree_leaf<Key, Order, Search, Value, BPlus, Summary>;
+  return static_cast<leaf *>(this)->next;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+btree<Key, Order, Search, Value, BPlus, Summary> *&
+btree<Key, Order, Search, Value, BPlus, Summary>::prev_leaf() {
+  static_assert(BPlus, "only B+ tree leaves are chained");
+  using leaf = btree_leaf<Key, Order, Search, Value, BPlus, Summary>;
+  return static_cast<leaf *>(this)->prev;
+}
+
+// btree_event names the structural changes a tree reports to its
+// debug hook (see btree_ptr::debug_hook).
+enum class btree_event {
+  split,         // the node was split; it is the left half
+  merge,         // a sibling was merged into the node
+  borrow,        // the node took a key from a sibling
+  new_root,      // a root split grew the tree; the node is the new root
+  root_collapse, // the root emptied out; the node is the new root
+};
+
+// Debug hooks cost a branch per structural change, so they are
+// compiled out of release (NDEBUG) builds. Define BTREE_DEBUG_HOOKS to
+// 0 or 1 to override that.
+#ifndef BTREE_DEBUG_HOOKS
+#ifdef NDEBUG
+#define BTREE_DEBUG_HOOKS 0
+#else
+#define BTREE_DEBUG_HOOKS 1
+#endif
+#endif
 
-  btree() : num_keys(0), is_leaf(true) {
-    keys.fill(0);
-    children.fill(nullptr);
+// btree_path records a walk down from the root: nodes[d] is the node
+// at depth d and slots[d] is the index of the child of it the walk
+// stepped into. Fixing things up on the way back up uses it instead of
+// searching each parent again.
+template <typename Node, int MaxDepth = 64> struct btree_path {
+  // Even a fan-out of 2 at every level couldn't fill 64.
+  static constexpr int max_depth = MaxDepth;
+
+  Node *nodes[max_depth];
+  int slots[max_depth];
+  int depth = 0;
+
+  void push(Node *node, int slot) {
+    assert(depth < max_depth);
+    nodes[depth] = node;
+    slots[depth] = slot;
+    depth++;
   }
 };
 
+// btree_iterator is a bidirectional iterator over a tree's keys in
+// ascending order (see begin, lower_bound and the rest below).
+// Dereferencing it gives the key, which can't be changed in place; in
+// a map, value() is the value that goes with it. Inserting or removing
+// a key invalidates every iterator into the tree.
+//
+// Stepping is amortized O(1). An iterator into a B-tree keeps the path
+// down from the root to its key, so moving on from a leaf goes back up
+// that path rather than searching again from the root. One into a B+
+// tree only needs its leaf, and moves along the leaf chain.
+template <typename Node> struct btree_iterator {
+  using iterator_category = bidirectional_iterator_tag;
+  using value_type = typename Node::key_type;
+  using difference_type = ptrdiff_t;
+  using pointer = const value_type *;
+  using reference = const value_type &;
+
+  // root is the root of the tree, for stepping back from the end.
+  Node *root;
+
+  // path leads down to the current key, keys[slot()] of node(). In a
+  // B-tree the slots above it are the children the path stepped into;
+  // in a B+ tree the path is just the leaf. At the end, it is empty.
+  typename conditional<Node::is_bplus, btree_path<Node, 1>,
+                       btree_path<Node>>::type path;
+
+  btree_iterator() : root(nullptr) {}
+  explicit btree_iterator(Node *root) : root(root) {}
+
+  Node *node() const { return path.nodes[path.depth - 1]; }
+  int slot() const { return path.slots[path.depth - 1]; }
+
+  reference operator*() const { return node()->keys[slot()]; }
+  pointer operator->() const { return &node()->keys[slot()]; }
+
+  // value is the value that goes with the key, in a map. With a summary
+  // policy it is const (see map_value_t).
+  auto &value() const {
+    if constexpr (Node::is_summarized) {
+      return as_const(node()->values[slot()]);
+    } else {
+      return node()->values[slot()];
+    }
+  }
+
+  btree_iterator &operator++();
+  btree_iterator &operator--();
+
+  btree_iterator operator++(int) {
+    btree_iterator old = *this;
+    ++*this;
+    return old;
+  }
+
+  btree_iterator operator--(int) {
+    btree_iterator old = *this;
+    --*this;
+    return old;
+  }
+
+  bool operator==(const btree_iterator &other) const {
+    if (path.depth == 0 || other.path.depth == 0) {
+      return path.depth == other.path.depth;
+    }
+    return node() == other.node() && slot() == other.slot();
+  }
+
+  bool operator!=(const btree_iterator &other) const {
+    return !(*this == other);
+  }
+
+  // first_below and last_below extend the path down to the first or
+  // last key under 'node', which must be the root or a child of node().
+  // settle moves a path that ends just past the last key of a leaf on
+  // to the next key, or the end.
+  void first_below(Node *node);
+  void last_below(Node *node);
+  void settle();
+};
+
+// btree_finger remembers the leaf that the last insert_near or
+// find_near through it ended up in, and the path down to it, so that
+// the next call can start there instead of at the root. It is good
+// until the tree is changed other than through it; a default-made
+// finger is empty and just sends the first call to the root.
+template <typename Node> struct btree_finger {
+  // path leads from the root to the leaf; the slots above the leaf are
+  // the children the path stepped into.
+  btree_path<Node> path;
+
+  Node *leaf() const { return path.nodes[path.depth - 1]; }
+
+  // covers returns whether key belongs in leaf() of the tree at root.
+  // The leaf's bounds are the nearest separators on either side of it
+  // along the path, so this mostly looks at the leaf's parent.
+  bool covers(const Node *root, const typename Node::key_type &key) const;
+};
+
+// btree_ptr is how callers hold on to a tree. It points at the root
+// node and owns the arenas every node of the tree is allocated from,
+// so following a child is a plain pointer load and dropping the
+// btree_ptr frees the whole tree at once. btree_ptr<> is a tree of
+// int keys with order 5.
+//
+// A btree_ptr can be moved but not copied. It starts out empty (a
+// null root); insert creates the root node on demand.
+template <typename Key = int, int Order = 5, typename Search = sorted_search,
+          typename Value = void, bool BPlus = false,
+          typename Summary = no_summary>
+struct btree_ptr {
+  using key_type = Key;
+  using mapped_type = Value;
+  using node_type = btree<Key, Order, Search, Value, BPlus, Summary>;
+  using leaf_type = btree_leaf<Key, Order, Search, Value, BPlus, Summary>;
+  using internal_type =
+      btree_internal<Key, Order, Search, Value, BPlus, Summary>;
+  using iterator = btree_iterator<node_type>;
+  using reverse_iterator = std::reverse_iterator<iterator>;
+  using finger = btree_finger<node_type>;
+
+  // root is the root node of the tree, or nullptr if the tree is empty.
+  node_type *root;
+
+  // key_count is the number of keys in the tree (see size).
+  size_t key_count;
+
+  // tail is the path to the rightmost leaf while a run of appends
+  // keeps it up to date, or empty; anything else that changes the
+  // tree's shape empties it.
+  finger tail;
+
+  // leaves and internals own every node reachable from root.
+  node_arena<leaf_type> leaves;
+  node_arena<internal_type> internals;
+
+#if BTREE_DEBUG_HOOKS
+  // debug_hook, if set, is called after every split, merge, borrow and
+  // root change with the node that changed. Only debug builds have it;
+  // wrap code that sets it in #if BTREE_DEBUG_HOOKS.
+  function<void(btree_event, node_type *)> debug_hook;
+#endif
+
+  btree_ptr() : root(nullptr), key_count(0) {}
+
+  btree_ptr(btree_ptr &&other) noexcept
+      : root(other.root), key_count(other.key_count), tail(other.tail),
+        leaves(std::move(other.leaves)),
+        internals(std::move(other.internals)) {
+#if BTREE_DEBUG_HOOKS
+    debug_hook = std::move(other.debug_hook);
+#endif
+    other.root = nullptr;
+    other.key_count = 0;
+    other.tail = finger();
+  }
+
+  btree_ptr &operator=(btree_ptr &&other) noexcept {
+    root = other.root;
+    key_count = other.key_count;
+    leaves = std::move(other.leaves);
+    internals = std::move(other.internals);
+#if BTREE_DEBUG_HOOKS
+    debug_hook = std::move(other.debug_hook);
+#endif
+    tail = other.tail;
+    other.root = nullptr;
+    other.key_count = 0;
+    other.tail = finger();
+    return *this;
+  }
+
+  // clear frees every node, leaving an empty tree.
+  void clear() {
+    root = nullptr;
+    key_count = 0;
+    tail = finger();
+    leaves = node_arena<leaf_type>();
+    internals = node_arena<internal_type>();
+  }
+
+  // new_leaf and new_internal allocate an empty node owned by this
+  // tree.
+  node_type *new_leaf() { return leaves.alloc(); }
+  node_type *new_internal() { return internals.alloc(); }
+
+  // free_node hands a node that has been unlinked from the tree back
+  // to the arena it came from.
+  void free_node(node_type *node) {
+    if (node->is_leaf) {
+      leaves.free(static_cast<leaf_type *>(node));
+    } else {
+      internals.free(static_cast<internal_type *>(node));
+    }
+  }
+
+  // size is the number of keys in the tree. Unlike count_keys, it
+  // doesn't walk the tree.
+  size_t size() const { return key_count; }
+
+  // live_nodes is the number of nodes currently allocated to the tree.
+  size_t live_nodes() const {
+    return leaves.live_nodes() + internals.live_nodes();
+  }
+
+  node_type *get() const { return root; }
+  node_type *operator->() const { return root; }
+  node_type &operator*() const { return *root; }
+  bool operator==(nullptr_t) const { return root == nullptr; }
+  bool operator!=(nullptr_t) const { return root != nullptr; }
+};
+
+// btree_map<Key, Value> is a tree that maps each key to a Value (see
+// btree above); btree_ptr<Key> is a set of keys.
+template <typename Key, typename Value, int Order = 5,
+          typename Search = sorted_search>
+using btree_map = btree_ptr<Key, Order, Search, Value>;
+
+// bplus_ptr is a B+ tree (see btree above) of keys, or with a Value, a
+// B+ tree map.
+template <typename Key = int, int Order = 5, typename Search = sorted_search,
+          typename Value = void>
+using bplus_ptr = btree_ptr<Key, Order, Search, Value, true>;
+
+// The API functions below take the key as nondeduced<Key>::type, so
+// that the tree alone decides what Key is; insert(tree, 5) works on a
+// tree of int64_t keys.
+template <typename T> struct nondeduced {
+  using type = T;
+};
+
 // insert adds the given key into a b-tree rooted at 'root'.  If the
-// key is already contained in the btree this should do nothing.
+// key is already contained in the btree this should do nothing. In a
+// map the new key gets a default-constructed value.
+//
+// A key bigger than every key in the tree is appended: it goes
+// straight to the rightmost leaf, whose path the tree keeps, and a
+// node it overfills is split at the end rather than in the middle.
+// Increasing keys, such as timestamps, then leave nodes nearly full
+// instead of half full. Only the right edge of the tree is left with
+// nodes below min_keys by this.
 //
 // On exit:
 // -- the 'root' pointer should refer to the root of the
 //    tree. (the root may change when we insert or remove)
 // -- the btree pointed to by 'root' is valid.
-void insert(shared_ptr<btree> &root, int key);
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+void insert(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+            const typename nondeduced<Key>::type &key);
+
+// insert_near and find_near are insert and find for keys that arrive
+// close together, such as timestamps. Each checks first whether key
+// belongs in the leaf 'hint' points at, and only goes down from the
+// root when it doesn't; either way hint is left at key's leaf for the
+// next call. A run of increasing or clustered keys then mostly skips
+// the walk down, making inserts O(1) amortized apart from splits.
+// insert_near returns whether the key was added.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool insert_near(
+    btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+    typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::finger
+        &hint,
+    const typename nondeduced<Key>::type &key);
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+btree<Key, Order, Search, Value, BPlus, Summary> *
+find_near(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+          typename btree_ptr<Key, Order, Search, Value, BPlus,
+                             Summary>::finger &hint,
+          const typename nondeduced<Key>::type &key);
+
+// insert_batch adds every key in [first, last) to the b-tree rooted
+// at 'root', in any order and skipping duplicates, as if each one were
+// passed to insert. The batch is sorted first so that it can be swept
+// through the tree once: each node is searched once for each run of
+// keys that lands in it rather than once per key.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary, typename Iter>
+void insert_batch(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+                  Iter first, Iter last);
+
+// insert_or_assign sets the value for key in a map, adding the key if
+// it isn't there. It returns true if the key was added, false if an
+// existing value was replaced. The value is moved into the tree, and
+// moved again (never copied) whenever the tree is rebalanced.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool insert_or_assign(
+    btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+    const typename nondeduced<Key>::type &key,
+    typename nondeduced<Value>::type value);
+
+// map_value_t is the value type find_value and iterators give access
+// to. A summary kept next to the children may depend on the values, so
+// in a map with a summary policy they are const: change them through
+// insert_or_assign, which keeps the summaries up to date.
+template <typename Value, typename Summary>
+using map_value_t =
+    conditional_t<is_same<Summary, no_summary>::value, Value, const Value>;
+
+// find_value returns a pointer to the value for key in a map, or
+// nullptr if the key isn't there. The pointer is good until the tree
+// is next changed.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+map_value_t<Value, Summary> *
+find_value(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+           const typename nondeduced<Key>::type &key);
 
 // remove deletes the given key from a b-tree rooted at 'root'. If the
-// key is not in the btree this should do nothing.
+// key is not in the btree this should do nothing. It returns whether
+// the key was there.
+//
+// remove makes a single pass down the tree to the key and then fixes
+// up only the nodes on that path (and their siblings) on the way back,
+// so it touches O(log n) nodes.
 //
 // On exit:
 // -- the 'root' pointer should refer to the root of the
 //    tree. (the root may change when we insert or delete)
 // -- the btree pointed to by 'root' is valid.
-void remove(shared_ptr<btree> &root, int key);
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool remove(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+            const typename nondeduced<Key>::type &key);
 
 // find locates the node that either: (a) currently contains this key,
 // or (b) the node that would contain it if we were to try to insert
-// it.  Note that this always returns a non-null node.
-shared_ptr<btree> find(shared_ptr<btree> &root, int key);
+// it. It returns nullptr only if the tree is empty. In a B+ tree the
+// node is always a leaf.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+btree<Key, Order, Search, Value, BPlus, Summary> *
+find(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+     const typename nondeduced<Key>::type &key);
+
+// contains_batch looks up keys[0..n) and sets bit i of found (bit
+// i % 64 of found[i / 64]) if keys[i] is in the tree, clearing it
+// otherwise; found needs room for (n + 63) / 64 words. The lookups are
+// run batch_group_size at a time, a level at a time: each one takes a
+// step down and prefetches the child it goes to before the next lookup
+// takes its step, so a group's cache misses overlap rather than queue
+// up behind each other. On trees bigger than the cache that is several
+// times faster than n separate finds. contains_interleaved (see
+// btree_coro.h) does the same with coroutines and a tunable width.
+constexpr int batch_group_size = 16;
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+void contains_batch(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+                    const Key *keys, size_t n, uint64_t *found);
+
+// begin and end are iterators to the first key of the tree and just
+// past its last key, and rbegin and rend go the other way. Together
+// they let a tree be used with range-for and standard algorithms.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator
+begin(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root);
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator
+end(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root);
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::reverse_iterator
+rbegin(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root);
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::reverse_iterator
+rend(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root);
+
+// lower_bound returns an iterator to the first key that is not less
+// than key, and upper_bound one to the first key greater than it;
+// either is end() if there is no such key. equal_range returns both.
+// Each searches down the tree once.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator
+lower_bound(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+            const typename nondeduced<Key>::type &key);
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator
+upper_bound(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+            const typename nondeduced<Key>::type &key);
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+pair<typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator,
+     typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator>
+equal_range(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+            const typename nondeduced<Key>::type &key);
+
+// scan calls visitor(keys, n) with every key in [lo, hi), in
+// ascending order, a run of consecutive keys at a time: keys points
+// at n (at least 1) keys inside a node, good until the tree changes.
+// In a B+ tree a run is the part of a leaf inside the range; in a
+// B-tree, runs from the leaves alternate with single separator keys.
+// scan stops early if visitor returns false. It searches down the tree
+// once, for lo, and returns how many keys it handed to visitor.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary, typename Visitor>
+size_t scan(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+            const typename nondeduced<Key>::type &lo,
+            const typename nondeduced<Key>::type &hi, Visitor visitor);
+
+// scan_into copies the keys in [lo, hi), in ascending order, into
+// buffer, stopping after max of them, and returns how many it copied.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+size_t scan_into(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+                 const typename nondeduced<Key>::type &lo,
+                 const typename nondeduced<Key>::type &hi, Key *buffer,
+                 size_t max);
+
+// rank_of returns how many keys in the tree are less than key, and
+// select returns an iterator to the key that has k keys less than it
+// (the k-th smallest, counting from 0), or end() if k is not less than
+// the tree's size. The tree needs a summary policy that counts keys,
+// such as subtree_counts; each then takes a single walk down the tree.
+// (rank_of isn't called rank so as not to clash with std::rank.)
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+size_t rank_of(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+               const typename nondeduced<Key>::type &key);
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator
+select(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root, size_t k);
+
+// aggregate returns the summary of the keys in [lo, hi), as kept by
+// the tree's summary policy: the number of keys with subtree_counts,
+// or with monoid_summary<Monoid> the number (.count) and Monoid over
+// their entries (.value). It walks down the two edges of the range and
+// takes the stored summaries of the subtrees in between, so it visits
+// O(log n) nodes however many keys are in the range.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename Summary::type
+aggregate(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+          const typename nondeduced<Key>::type &lo,
+          const typename nondeduced<Key>::type &hi);
+
+// bulk_load replaces the contents of the tree rooted at 'root' with
+// the keys in [first, last), which must be in ascending order with no
+// duplicates (in a map, each gets a default-constructed value). Rather
+// than inserting them one at a time it writes the leaves left to
+// right, each about fill_factor full (the result is always a valid
+// btree, so very low or high fill factors are clamped), then builds
+// each level of internal nodes over the one below. This takes linear
+// time and touches memory sequentially.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary, typename Iter>
+void bulk_load(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root,
+               Iter first, Iter last, double fill_factor = 1.0);
 
 // count_nodes returns the number of nodes referenced by this
 // btree. If this node is NULL, count_nodes returns zero; if it is a
 // root, it returns 1; otherwise it returns 1 plus however many nodes
 // are accessable via any valid child links.
-int count_nodes(shared_ptr<btree> &root);
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+int count_nodes(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root);
 
 // count_keys returns the total number of keys stored in this
 // btree. If the root node is null it returns zero; otherwise it
 // returns the number of keys in the root plus however many keys are
-// contained in valid child links.
-int count_keys(shared_ptr<btree> &root);
+// contained in valid child links. It walks the whole tree;
+// btree_ptr::size gives the same answer in O(1).
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+int count_keys(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &root);
+
+#include "btree_impl.h"
+
+// Coroutine lookups (contains_interleaved), when the compiler has them
+#ifdef __cpp_impl_coroutine
+#include "btree_coro.h"
+#endif
 
 #endif
@@ -0,0 +1,95 @@
+// btree_arena.h
+//
+// node_arena hands out btree nodes from large contiguous slabs instead
+// of one heap allocation (plus a shared_ptr control block) per node.
+// Nodes that are merged away go on a free list and are reused by the
+// next split. Everything is released at once when the arena is
+// destroyed, so a tree never has to walk itself to free its nodes.
+
+#ifndef btree_arena_h
+#define btree_arena_h
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+template <typename Node> class node_arena {
+public:
+  node_arena() : used(slab_nodes), live(0) {}
+
+  // Moving an arena moves the slabs, so node addresses stay valid.
+  node_arena(node_arena &&other) noexcept
+      : slabs(std::move(other.slabs)), used(other.used), live(other.live),
+        free_list(std::move(other.free_list)) {
+    other.reset();
+  }
+
+  node_arena &operator=(node_arena &&other) noexcept {
+    if (this != &other) {
+      slabs = std::move(other.slabs);
+      used = other.used;
+      live = other.live;
+      free_list = std::move(other.free_list);
+      other.reset();
+    }
+    return *this;
+  }
+
+  // An arena owns its nodes; copying it would leave two trees
+  // pointing into the same slabs.
+  node_arena(const node_arena &) = delete;
+  node_arena &operator=(const node_arena &) = delete;
+
+  // alloc returns a freshly initialized node. It prefers a node from
+  // the free list, then the next unused slot of the current slab, and
+  // only goes to the heap when the slab is full.
+  Node *alloc() {
+    live++;
+    if (!free_list.empty()) {
+      Node *node = free_list.back();
+      free_list.pop_back();
+      *node = Node();
+      return node;
+    }
+
+    if (used == slab_nodes) {
+      slabs.emplace_back(new Node[slab_nodes]);
+      used = 0;
+    }
+    return &slabs.back()[used++];
+  }
+
+  // free hands a node that is no longer linked into the tree back to
+  // the arena for reuse.
+  void free(Node *node) {
+    live--;
+    free_list.push_back(node);
+  }
+
+  // live_nodes is the number of nodes handed out and not yet freed.
+  size_t live_nodes() const { return live; }
+
+  // slab_count is the number of slabs the arena has allocated.
+  size_t slab_count() const { return slabs.size(); }
+
+  // Nodes per slab: roughly 16KB worth, but never fewer than 4.
+  static constexpr size_t slab_nodes =
+      16384 / sizeof(Node) < 4 ? 4 : 16384 / sizeof(Node);
+
+private:
+  void reset() {
+    slabs.clear();
+    free_list.clear();
+    used = slab_nodes;
+    live = 0;
+  }
+
+  vector<unique_ptr<Node[]>> slabs;
+  size_t used;
+  size_t live;
+  vector<Node *> free_list;
+};
+
+#endif
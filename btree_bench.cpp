@@ -0,0 +1,366 @@
+//
+// btree_bench.cpp
+//
+// Compares the ways a node can be searched, at the orders where the
+// choice matters. "make bench" builds it with optimizations on; run
+// ./btree_bench and compare the ns/search columns.
+//
+// The first table times one node's worth of keys (Order - 1 of them)
+// in isolation; the second times whole-tree lookups, where the index
+// also changes how much of each node a search touches. The third
+// compares one find at a time against contains_batch, which overlaps
+// the cache misses of a group of lookups, and the last shows how
+// contains_interleaved (coroutine lookups) scales with the number of
+// lookups it keeps in flight. The next times inserting increasing keys
+// with insert and with insert_near, and the last runs a mixed workload
+// (90% contains, 5% insert, 5% remove) on a concurrent_btree with latch
+// crabbing, on one with optimistic lock coupling, on a blink_btree and
+// on a btree_ptr behind one mutex, with more and more threads. The
+// last compares a persistent_btree's path-copying inserts with
+// btree_ptr's, and its O(1) snapshot with copying a btree_ptr's keys
+// into a new one.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "btree.h"
+#include "btree_blink.h"
+#include "btree_concurrent.h"
+#include "btree_persistent.h"
+
+using namespace std;
+
+namespace {
+
+constexpr int node_searches = 1 << 22;
+constexpr int tree_keys = 1 << 20;
+constexpr int tree_lookups = 1 << 21;
+
+// sink keeps the compiler from throwing away the searches.
+volatile long sink;
+
+template <typename Fn> double ns_per_call(int calls, Fn fn) {
+  auto start = chrono::steady_clock::now();
+  long total = 0;
+  for (int i = 0; i < calls; i++) {
+    total += fn(i);
+  }
+  auto end = chrono::steady_clock::now();
+  sink = total;
+  return chrono::duration<double, nano>(end - start).count() / calls;
+}
+
+template <int Order> void bench_node(const vector<int32_t> &targets) {
+  const int n = Order - 1;
+  vector<int32_t> keys(n);
+  for (int i = 0; i < n; i++) {
+    keys[i] = 2 * i + 1;
+  }
+  sampled_search<>::node_index<int32_t, Order> samples{};
+  sampled_search<>::rebuild(samples, keys.data(), n);
+  eytzinger_search::node_index<int32_t, Order> eytzinger{};
+  eytzinger_search::rebuild(eytzinger, keys.data(), n);
+
+  const int32_t *k = keys.data();
+  auto target = [&](int i) { return targets[i] % (2 * n + 2); };
+
+  double lower = ns_per_call(node_searches, [&](int i) {
+    return (long)(lower_bound(k, k + n, target(i)) - k);
+  });
+  double scalar = ns_per_call(node_searches, [&](int i) {
+    return (long)search_keys_scalar(k, n, target(i));
+  });
+  double sorted = ns_per_call(node_searches, [&](int i) {
+    return (long)search_keys(k, n, target(i));
+  });
+#ifdef BTREE_SIMD_SEARCH
+  double scan = ns_per_call(node_searches, [&](int i) {
+    return (long)count_less(k, n, target(i));
+  });
+#else
+  double scan = 0;
+#endif
+  double sampled = ns_per_call(node_searches, [&](int i) {
+    return (long)sampled_search<>::search(samples, k, n, target(i));
+  });
+  double eyt = ns_per_call(node_searches, [&](int i) {
+    return (long)eytzinger_search::search(eytzinger, k, n, target(i));
+  });
+
+  printf("%5d %10.2f %10.2f %10.2f %10.2f %10.2f %10.2f\n", Order, lower,
+         scalar, sorted, scan, sampled, eyt);
+}
+
+template <int Order, typename Search>
+double bench_tree(const vector<int32_t> &keys,
+                  const vector<int32_t> &lookups) {
+  btree_ptr<int32_t, Order, Search> tree;
+  for (int32_t key : keys) {
+    insert(tree, key);
+  }
+  return ns_per_call(tree_lookups, [&](int i) {
+    btree<int32_t, Order, Search> *node = find(tree, lookups[i]);
+    return (long)node->num_keys;
+  });
+}
+
+template <int Order>
+void bench_trees(const vector<int32_t> &keys,
+                 const vector<int32_t> &lookups) {
+  double sorted = bench_tree<Order, sorted_search>(keys, lookups);
+  double sampled = bench_tree<Order, sampled_search<>>(keys, lookups);
+  double eyt = bench_tree<Order, eytzinger_search>(keys, lookups);
+  printf("%5d %10.2f %10.2f %10.2f\n", Order, sorted, sampled, eyt);
+}
+
+template <int Order>
+void bench_batch(const vector<int32_t> &keys,
+                 const vector<int32_t> &lookups) {
+  btree_ptr<int32_t, Order> tree;
+  for (int32_t key : keys) {
+    insert(tree, key);
+  }
+  double single = ns_per_call(tree_lookups, [&](int i) {
+    btree<int32_t, Order> *node = find(tree, lookups[i]);
+    return (long)node->num_keys;
+  });
+
+  vector<uint64_t> found((tree_lookups + 63) / 64);
+  auto start = chrono::steady_clock::now();
+  contains_batch(tree, lookups.data(), lookups.size(), found.data());
+  auto end = chrono::steady_clock::now();
+  sink = (long)found[0];
+  double batch = chrono::duration<double, nano>(end - start).count() /
+                 tree_lookups;
+  printf("%5d %10.2f %10.2f\n", Order, single, batch);
+}
+
+#ifdef __cpp_impl_coroutine
+const int widths[] = {1, 2, 4, 8, 16, 32, 64};
+
+// Prints millions of lookups per second at each interleave width
+template <int Order>
+void bench_interleaved(const vector<int32_t> &keys,
+                       const vector<int32_t> &lookups) {
+  btree_ptr<int32_t, Order> tree;
+  for (int32_t key : keys) {
+    insert(tree, key);
+  }
+  vector<uint64_t> found((tree_lookups + 63) / 64);
+  printf("%5d", Order);
+  for (int width : widths) {
+    auto start = chrono::steady_clock::now();
+    contains_interleaved(tree, lookups.data(), lookups.size(), found.data(),
+                         width);
+    auto end = chrono::steady_clock::now();
+    sink = (long)found[0];
+    double us = chrono::duration<double, micro>(end - start).count();
+    printf(" %7.2f", tree_lookups / us);
+  }
+  printf("\n");
+}
+#endif
+
+// Prints ns per insert of tree_keys increasing keys, from the root
+// each time and then through a finger
+template <int Order> void bench_sequential() {
+  btree_ptr<int32_t, Order> plain;
+  double root = ns_per_call(tree_keys, [&](int i) {
+    insert(plain, i);
+    return 0L;
+  });
+  btree_ptr<int32_t, Order> fingered;
+  typename btree_ptr<int32_t, Order>::finger hint;
+  double near = ns_per_call(tree_keys, [&](int i) {
+    return (long)insert_near(fingered, hint, i);
+  });
+  printf("%5d %10.2f %11.2f\n", Order, root, near);
+}
+
+constexpr int mixed_ops = 1 << 20;
+
+// Runs mixed_ops operations split across threads, each doing op(rng)
+// in a loop, and returns millions of operations per second.
+template <typename Op> double mops(int threads, Op op) {
+  vector<thread> workers;
+  auto start = chrono::steady_clock::now();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      mt19937 rng(t);
+      long total = 0;
+      for (int i = 0; i < mixed_ops / threads; i++) {
+        total += op(rng);
+      }
+      sink = total;
+    });
+  }
+  for (thread &worker : workers) {
+    worker.join();
+  }
+  auto end = chrono::steady_clock::now();
+  return mixed_ops / chrono::duration<double, micro>(end - start).count();
+}
+
+// One operation of the mixed workload on a concurrent_btree or
+// blink_btree
+template <typename Tree> long mixed_op(Tree &tree, mt19937 &rng) {
+  int32_t key = (int32_t)(rng() % (2 * tree_keys));
+  switch (rng() % 20) {
+  case 0:
+    return (long)insert(tree, key);
+  case 1:
+    return (long)remove(tree, key);
+  default:
+    return (long)contains(tree, key);
+  }
+}
+
+void bench_concurrent(const vector<int32_t> &keys, int threads) {
+  concurrent_btree<int32_t, 64> shared;
+  concurrent_btree<int32_t, 64, true> versioned;
+  blink_btree<int32_t, 64> linked;
+  btree_ptr<int32_t, 64> locked;
+  mutex lock;
+  for (int32_t key : keys) {
+    insert(shared, key);
+    insert(versioned, key);
+    insert(linked, key);
+    insert(locked, key);
+  }
+
+  auto latched =
+      mops(threads, [&](mt19937 &rng) { return mixed_op(shared, rng); });
+  auto optimistic =
+      mops(threads, [&](mt19937 &rng) { return mixed_op(versioned, rng); });
+  auto blink =
+      mops(threads, [&](mt19937 &rng) { return mixed_op(linked, rng); });
+  auto global = mops(threads, [&](mt19937 &rng) {
+    int32_t key = (int32_t)(rng() % (2 * tree_keys));
+    lock_guard<mutex> hold(lock);
+    switch (rng() % 20) {
+    case 0:
+      insert(locked, key);
+      return 0L;
+    case 1:
+      return (long)remove(locked, key);
+    default:
+      return (long)find(locked, key)->num_keys;
+    }
+  });
+  printf("%7d %10.2f %10.2f %10.2f %10.2f\n", threads, latched, optimistic,
+         blink, global);
+}
+
+// Prints ns per insert of the shuffled keys into a btree_ptr and a
+// persistent_btree, then ns to snapshot the persistent tree and to copy
+// the btree_ptr.
+template <int Order> void bench_persistent(const vector<int32_t> &keys) {
+  btree_ptr<int32_t, Order> plain;
+  double in_place = ns_per_call(tree_keys, [&](int i) {
+    insert(plain, keys[i]);
+    return 0L;
+  });
+  persistent_btree<int32_t, Order> versioned;
+  double copied = ns_per_call(tree_keys, [&](int i) {
+    return (long)insert(versioned, keys[i]);
+  });
+
+  vector<persistent_btree<int32_t, Order>> snapshots;
+  snapshots.reserve(1000);
+  double snapshot = ns_per_call(1000, [&](int) {
+    snapshots.push_back(versioned.snapshot());
+    return (long)snapshots.back().size();
+  });
+  vector<int32_t> buffer(tree_keys);
+  double copy = ns_per_call(10, [&](int) {
+    size_t n = scan_into(plain, INT32_MIN, INT32_MAX, buffer.data(),
+                         buffer.size());
+    btree_ptr<int32_t, Order> copy;
+    bulk_load(copy, buffer.begin(), buffer.begin() + n);
+    return (long)n;
+  });
+  printf("%5d %10.2f %10.2f %10.2f %10.0f\n", Order, in_place, copied,
+         snapshot, copy);
+}
+
+} // namespace
+
+int main() {
+  mt19937 rng(42);
+  vector<int32_t> targets(node_searches);
+  for (int32_t &t : targets) {
+    t = (int32_t)(rng() & 0x7fffffff);
+  }
+
+  printf("ns per search of one node (Order - 1 int32 keys)\n");
+  printf("%5s %10s %10s %10s %10s %10s %10s\n", "order", "std::lb",
+         "branchless", "search_key", "simd scan", "sampled", "eytzinger");
+  bench_node<16>(targets);
+  bench_node<64>(targets);
+  bench_node<128>(targets);
+  bench_node<256>(targets);
+
+  vector<int32_t> keys(tree_keys);
+  for (int i = 0; i < tree_keys; i++) {
+    keys[i] = 2 * i;
+  }
+  shuffle(keys.begin(), keys.end(), rng);
+  vector<int32_t> lookups(tree_lookups);
+  for (int32_t &l : lookups) {
+    l = (int32_t)(rng() % (2 * tree_keys));
+  }
+
+  printf("\nns per find in a tree of %d int32 keys\n", tree_keys);
+  printf("%5s %10s %10s %10s\n", "order", "sorted", "sampled",
+         "eytzinger");
+  bench_trees<16>(keys, lookups);
+  bench_trees<64>(keys, lookups);
+  bench_trees<128>(keys, lookups);
+  bench_trees<256>(keys, lookups);
+
+  printf("\nns per lookup in a tree of %d int32 keys\n", tree_keys);
+  printf("%5s %10s %10s\n", "order", "find", "batch");
+  bench_batch<16>(keys, lookups);
+  bench_batch<64>(keys, lookups);
+  bench_batch<256>(keys, lookups);
+
+#ifdef __cpp_impl_coroutine
+  printf("\nmillion lookups/s with contains_interleaved, by width\n");
+  printf("%5s", "order");
+  for (int width : widths) {
+    printf(" %7d", width);
+  }
+  printf("\n");
+  bench_interleaved<16>(keys, lookups);
+  bench_interleaved<64>(keys, lookups);
+  bench_interleaved<256>(keys, lookups);
+#endif
+
+  printf("\nns per insert of %d increasing int32 keys\n", tree_keys);
+  printf("%5s %10s %11s\n", "order", "insert", "insert_near");
+  bench_sequential<16>();
+  bench_sequential<64>();
+  bench_sequential<256>();
+
+  printf("\nmillion mixed ops/s on %d int32 keys (%u hardware threads)\n",
+         tree_keys, thread::hardware_concurrency());
+  printf("%7s %10s %10s %10s %10s\n", "threads", "crabbing", "optimistic",
+         "b-link", "one mutex");
+  for (int threads : {1, 2, 4, 8}) {
+    bench_concurrent(keys, threads);
+  }
+
+  printf("\nns per insert of %d int32 keys, and per copy of the tree\n",
+         tree_keys);
+  printf("%5s %10s %10s %10s %10s\n", "order", "btree_ptr", "persistent",
+         "snapshot", "deep copy");
+  bench_persistent<16>(keys);
+  bench_persistent<64>(keys);
+  return 0;
+}
@@ -0,0 +1,269 @@
+// btree_blink.h
+//
+// blink_btree is a B+ tree set for many threads, after Lehman and Yao's
+// B-link tree. Every node has a link to the next node right of it on
+// its level, and a high key that is above every key under it (the last
+// node on a level has none). A split moves the upper half of a node
+// into a new node and links it in to the right, all under the latch of
+// the node being split, and only then adds the separator to the parent.
+// Until it does, the new node is reached through the right link: anyone
+// who lands on a node whose high key isn't above their key moves right.
+//
+// So nobody needs to hold a parent's latch while it latches a child.
+// Readers hold one shared latch at a time. Writers go down the same way
+// and latch only the leaf exclusively; after a split they hold two, the
+// node that split and its parent (or, moving right, the parent's right
+// sibling), never a path. In concurrent_btree a writer whose leaf could
+// split instead holds every node down from the last safe one, often the
+// root.
+//
+// As in Lehman and Yao's tree, remove only takes keys out of leaves:
+// nodes never merge, and may run low on keys or empty. No node is ever
+// unlinked, so nodes are freed only with the tree.
+
+#ifndef btree_blink_h
+#define btree_blink_h
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <shared_mutex>
+
+#include "btree_concurrent.h"
+
+using namespace std;
+
+template <typename Key, int Order> struct blink_node : node_limits<Order> {
+  using key_type = Key;
+  using child_type = blink_node *;
+
+  shared_mutex latch;
+
+  // Leaves are on level 0, their parents on level 1 and so on. A node
+  // stays on its level for its whole life.
+  const int level;
+  const bool is_leaf;
+  int num_keys = 0;
+
+  // Every key under the node is below high_key, if has_high_key.
+  bool has_high_key = false;
+  Key high_key{};
+
+  // The next node on the same level, or nullptr for the last one
+  blink_node *right = nullptr;
+
+  array<Key, Order> keys;
+  array<blink_node *, Order + 1> children{};
+
+  // child is children[i], for the helpers in btree_node_ops.h.
+  blink_node *&child(int i) { return children[i]; }
+
+  explicit blink_node(int level) : level(level), is_leaf(level == 0) {}
+};
+
+template <typename Key = int, int Order = 64> struct blink_btree {
+  using key_type = Key;
+  using node_type = blink_node<Key, Order>;
+
+  // Held only to put in a new root.
+  mutex root_latch;
+
+  // root is the root node, or nullptr until the first insert. Readers
+  // load it without root_latch: a root that has since been replaced is
+  // still the first node on its level, and moving right from it finds
+  // any key on that level.
+  atomic<node_type *> root{nullptr};
+
+  atomic<size_t> key_count{0};
+
+  blink_btree() = default;
+  blink_btree(const blink_btree &) = delete;
+  blink_btree &operator=(const blink_btree &) = delete;
+  ~blink_btree() {
+    // The first node on each level is the first child of the one above,
+    // and the right links reach the rest.
+    node_type *first = root.load();
+    while (first != nullptr) {
+      node_type *below = first->is_leaf ? nullptr : first->children[0];
+      while (first != nullptr) {
+        node_type *next = first->right;
+        delete first;
+        first = next;
+      }
+      first = below;
+    }
+  }
+
+  // size is the number of keys in the tree.
+  size_t size() const { return key_count.load(); }
+};
+
+template <typename Node> void blink_lock(Node *node, bool exclusive) {
+  if (exclusive) {
+    node->latch.lock();
+  } else {
+    node->latch.lock_shared();
+  }
+}
+
+template <typename Node> void blink_unlock(Node *node, bool exclusive) {
+  if (exclusive) {
+    node->latch.unlock();
+  } else {
+    node->latch.unlock_shared();
+  }
+}
+
+// Follows right links from node, which is latched, until it gets to the
+// node key belongs in, and returns that one latched instead.
+template <typename Node>
+Node *move_right(Node *node, const typename Node::key_type &key,
+                 bool exclusive) {
+  while (node->has_high_key && !(key < node->high_key)) {
+    Node *right = node->right;
+    blink_unlock(node, exclusive);
+    blink_lock(right, exclusive);
+    node = right;
+  }
+  return node;
+}
+
+// Goes down a non-empty tree to the node on level that key belongs in,
+// holding one latch at a time, and returns it latched (exclusively if
+// exclusive). If path isn't null, it gets the node the walk went down
+// from on each level above.
+template <typename Tree>
+typename Tree::node_type *
+blink_descend(Tree &tree, const typename Tree::key_type &key, int level,
+              bool exclusive,
+              btree_path<typename Tree::node_type> *path = nullptr) {
+  using Node = typename Tree::node_type;
+  Node *node = tree.root.load(memory_order_acquire);
+  blink_lock(node, exclusive && node->level == level);
+  while (true) {
+    node = move_right(node, key, exclusive && node->level == level);
+    if (node->level == level) {
+      return node;
+    }
+    int slot = child_slot(node, key);
+    Node *child = node->children[slot];
+    if (path != nullptr) {
+      path->push(node, slot);
+    }
+    node->latch.unlock_shared();
+    blink_lock(child, exclusive && child->level == level);
+    node = child;
+  }
+}
+
+// Splits node, which is latched and one key over max_keys, moving its
+// upper half into a new node linked in to its right. node's high key is
+// then the separator for the parent.
+template <typename Node> Node *blink_split(Node *node) {
+  Node *right = new Node(node->level);
+  typename Node::key_type separator = node_split(node, right);
+  right->has_high_key = node->has_high_key;
+  right->high_key = node->high_key;
+  right->right = node->right;
+
+  node->has_high_key = true;
+  node->high_key = separator;
+  node->right = right;
+  return right;
+}
+
+// contains returns whether key is in the tree.
+template <typename Key, int Order>
+bool contains(blink_btree<Key, Order> &tree,
+              const typename nondeduced<Key>::type &key) {
+  using Node = blink_node<Key, Order>;
+  if (tree.root.load(memory_order_acquire) == nullptr) {
+    return false;
+  }
+  Node *leaf = blink_descend(tree, key, 0, false);
+  int idx = search_keys(leaf->keys.data(), leaf->num_keys, key);
+  bool found = idx < leaf->num_keys && leaf->keys[idx] == key;
+  leaf->latch.unlock_shared();
+  return found;
+}
+
+// insert adds key to the tree, returning whether it wasn't there yet.
+template <typename Key, int Order>
+bool insert(blink_btree<Key, Order> &tree,
+            const typename nondeduced<Key>::type &key) {
+  using Node = blink_node<Key, Order>;
+  if (tree.root.load(memory_order_acquire) == nullptr) {
+    lock_guard<mutex> hold(tree.root_latch);
+    if (tree.root.load() == nullptr) {
+      tree.root.store(new Node(0), memory_order_release);
+    }
+  }
+
+  btree_path<Node> path;
+  Node *node = blink_descend(tree, key, 0, true, &path);
+  int idx = search_keys(node->keys.data(), node->num_keys, key);
+  if (idx < node->num_keys && node->keys[idx] == key) {
+    node->latch.unlock();
+    return false;
+  }
+  node_insert_at(node, idx, key);
+  tree.key_count++;
+
+  // Latches are only ever taken going up a level or right along one,
+  // so holding node while the parent is latched can't deadlock.
+  while (node->num_keys > Node::max_keys) {
+    Node *right = blink_split(node);
+    Key separator = node->high_key;
+
+    Node *parent;
+    if (path.depth > 0) {
+      parent = path.nodes[--path.depth];
+      parent->latch.lock();
+    } else {
+      unique_lock<mutex> hold(tree.root_latch);
+      if (tree.root.load() == node) {
+        Node *root = new Node(node->level + 1);
+        root->keys[0] = separator;
+        root->child(0) = node;
+        root->child(1) = right;
+        root->num_keys = 1;
+        tree.root.store(root, memory_order_release);
+        break;
+      }
+      // A new root went in after the walk passed this level; find the
+      // parent from the top.
+      hold.unlock();
+      parent = blink_descend(tree, separator, node->level + 1, true);
+    }
+    parent = move_right(parent, separator, true);
+    int slot = search_keys(parent->keys.data(), parent->num_keys, separator);
+    node_insert_at(parent, slot, separator, right);
+    node->latch.unlock();
+    node = parent;
+  }
+  node->latch.unlock();
+  return true;
+}
+
+// remove deletes key from the tree, returning whether it was there. The
+// leaf is never merged, however few keys it has left.
+template <typename Key, int Order>
+bool remove(blink_btree<Key, Order> &tree,
+            const typename nondeduced<Key>::type &key) {
+  using Node = blink_node<Key, Order>;
+  if (tree.root.load(memory_order_acquire) == nullptr) {
+    return false;
+  }
+  Node *leaf = blink_descend(tree, key, 0, true);
+  int idx = search_keys(leaf->keys.data(), leaf->num_keys, key);
+  bool found = idx < leaf->num_keys && leaf->keys[idx] == key;
+  if (found) {
+    node_remove_at(leaf, idx);
+    tree.key_count--;
+  }
+  leaf->latch.unlock();
+  return found;
+}
+
+#endif
@@ -0,0 +1,639 @@
+// btree_concurrent.h
+//
+// concurrent_btree is a B+ tree set that many threads can use at once,
+// through insert, remove and contains. Each node has its own
+// reader/writer latch, and every operation goes down the tree by latch
+// crabbing (lock coupling): it latches a child before letting go of
+// the parent, so no thread ever sees a node half way through a split
+// or merge.
+//
+// Readers hold shared latches, at most two at a time. A writer first
+// goes down the same way and latches only the leaf exclusively; most
+// inserts and removes fit in the leaf, so writers in different leaves
+// don't block each other, or readers, above the leaves. If the leaf
+// could split or underflow, the writer starts over and takes exclusive
+// latches all the way down, letting go of everything above a node as
+// soon as the node is safe: an insert below it can't split it (it has
+// room for a key) and a remove can't merge it away (it has a key to
+// spare). The splits and merges then only touch nodes it holds.
+//
+// root_latch guards the root pointer itself, and is held the same way
+// as a latch on a node above the root.
+//
+// concurrent_btree<Key, Order, true> uses optimistic lock coupling
+// instead. A node's latch is then a version number, with a bit that
+// says a writer has it: a writer bumps the version when it lets go.
+// Readers write nothing at all, not even a latch. They note a node's
+// version, read the node, and check the version is still the same
+// before they trust what they read (and before they follow a child
+// pointer they read); if it isn't, they start over from the root.
+// Read-mostly workloads then don't bounce latch cache lines between
+// cores. Writers go down the same way and take the leaf's latch only
+// if its version hasn't moved, and otherwise work as above, with the
+// version latches held exclusively. A reader may read a node while a
+// writer is changing it, so in an optimistic tree every key, child and
+// count is stored and loaded through a relaxed atomic_ref (which is why
+// keys must be trivially copyable), and what a reader loads is only
+// used once the version check has passed.
+//
+// A node a merge takes out of an optimistic tree is marked obsolete
+// (which sends any reader still in it back to the root), but readers
+// hold no latch that would keep it alive. Every operation on an
+// optimistic tree runs inside an epoch_guard, and the node is handed to
+// the tree's epoch_reclaimer (see btree_epoch.h), which frees it once
+// every operation that could have reached it is over.
+
+#ifndef btree_concurrent_h
+#define btree_concurrent_h
+
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <thread>
+#include <type_traits>
+
+#include "btree.h"
+#include "btree_epoch.h"
+#include "btree_node_ops.h"
+
+using namespace std;
+
+// optimistic_latch is the version latch of optimistic lock coupling.
+// Bit 1 of version is set while a writer holds the latch, and bit 0
+// once the node has been taken out of the tree; the rest counts how
+// many times a writer has let go.
+class optimistic_latch {
+public:
+  // Waits until no writer holds the latch and returns the version to
+  // check reads against, setting restart if the node is obsolete.
+  uint64_t read_lock(bool &restart) const {
+    uint64_t v = version.load(memory_order_acquire);
+    while (v & locked_bit) {
+      this_thread::yield();
+      v = version.load(memory_order_acquire);
+    }
+    if (v & obsolete_bit) {
+      restart = true;
+    }
+    return v;
+  }
+
+  // Sets restart if a writer has had the latch since read_lock returned
+  // v, in which case anything read from the node since may be torn.
+  void validate(uint64_t v, bool &restart) const {
+    atomic_thread_fence(memory_order_acquire);
+    if (version.load(memory_order_relaxed) != v) {
+      restart = true;
+    }
+  }
+
+  // Takes the latch for writing if nobody has had it since read_lock
+  // returned v, and returns whether it did.
+  bool try_upgrade(uint64_t v) {
+    if (!version.compare_exchange_strong(v, v + locked_bit,
+                                         memory_order_acquire)) {
+      return false;
+    }
+    // A reader that loads anything the writer stores from here on must
+    // then see the locked version when it validates.
+    atomic_thread_fence(memory_order_release);
+    return true;
+  }
+
+  // lock and unlock take and let go of the latch for writing, like a
+  // mutex's.
+  void lock() {
+    while (true) {
+      uint64_t v = version.load(memory_order_relaxed);
+      if (!(v & locked_bit) && try_upgrade(v)) {
+        return;
+      }
+      this_thread::yield();
+    }
+  }
+  void unlock() { version.fetch_add(locked_bit, memory_order_release); }
+
+  // Lets go of the latch on a node that has been taken out of the tree.
+  void unlock_obsolete() {
+    version.fetch_add(locked_bit | obsolete_bit, memory_order_release);
+  }
+
+private:
+  static constexpr uint64_t obsolete_bit = 1;
+  static constexpr uint64_t locked_bit = 2;
+
+  atomic<uint64_t> version{0};
+};
+
+template <typename Key, int Order, typename Latch = shared_mutex>
+struct concurrent_node : node_limits<Order> {
+  using key_type = Key;
+  using child_type = concurrent_node *;
+
+  // Optimistic readers read a node while a writer may be changing it;
+  // see node_store and optimistic_load.
+  static constexpr bool racy_reads = is_same_v<Latch, optimistic_latch>;
+
+  Latch latch;
+
+  // A node is a leaf or an internal node for its whole life, so is_leaf
+  // can be read by anyone who can reach the node.
+  const bool is_leaf;
+  int num_keys = 0;
+
+  // Like btree's, the arrays have room for one key (and child) over
+  // the limit, which a split then takes away.
+  array<Key, Order> keys;
+  array<concurrent_node *, Order + 1> children{};
+
+  // child is children[i], for the helpers in btree_node_ops.h.
+  concurrent_node *&child(int i) { return children[i]; }
+
+  explicit concurrent_node(bool is_leaf) : is_leaf(is_leaf) {}
+};
+
+template <typename Key = int, int Order = 64, bool Optimistic = false>
+struct concurrent_btree {
+  using key_type = Key;
+  using latch_type = conditional_t<Optimistic, optimistic_latch, shared_mutex>;
+  using node_type = concurrent_node<Key, Order, latch_type>;
+
+  static constexpr bool optimistic = Optimistic;
+  using reclaimer_type =
+      conditional_t<Optimistic, epoch_reclaimer, no_reclaimer>;
+  using guard_type = conditional_t<Optimistic, epoch_guard, no_epoch_guard>;
+  static_assert(!Optimistic || is_trivially_copyable_v<Key>,
+                "optimistic readers copy keys that may be changing");
+
+  latch_type root_latch;
+
+  // root is the root node, or nullptr until the first insert. It is
+  // atomic only because optimistic readers load it without root_latch.
+  atomic<node_type *> root{nullptr};
+
+  atomic<size_t> key_count{0};
+
+  // Frees the nodes merges take out of an optimistic tree; the others
+  // free them on the spot and have nothing to reclaim.
+  [[no_unique_address]] reclaimer_type reclaimer;
+
+  concurrent_btree() = default;
+  concurrent_btree(const concurrent_btree &) = delete;
+  concurrent_btree &operator=(const concurrent_btree &) = delete;
+  ~concurrent_btree() { free_subtree(root.load()); }
+
+  // size is the number of keys in the tree.
+  size_t size() const { return key_count.load(); }
+
+private:
+  static void free_subtree(node_type *node) {
+    if (node == nullptr) {
+      return;
+    }
+    for (int i = 0; !node->is_leaf && i <= node->num_keys; i++) {
+      free_subtree(node->children[i]);
+    }
+    delete node;
+  }
+};
+
+// Splits parent->children[slot], which is one key over max_keys, as
+// split_child does for a B+ tree. The caller holds both latches; the
+// new right node can't be reached until the parent is unlatched.
+template <typename Node> void concurrent_split(Node *parent, int slot) {
+  Node *left = parent->children[slot];
+  Node *right = new Node(left->is_leaf);
+  node_insert_at(parent, slot, node_split(left, right), right);
+}
+
+// Lets go of a node that has just been taken out of the tree, and frees
+// it, or in an optimistic tree marks it obsolete and retires it.
+template <typename Tree>
+void retire_node(Tree &tree, typename Tree::node_type *node) {
+  if constexpr (Tree::optimistic) {
+    node->latch.unlock_obsolete();
+    tree.reclaimer.retire(node);
+  } else {
+    node->latch.unlock();
+    delete node;
+  }
+}
+
+// Tops up parent->children[slot], which has dropped below min_keys, by
+// borrowing from or merging with a sibling, as fix_underflow does. The
+// caller holds the parent and the node; this latches the sibling, and
+// lets go of both the node and the sibling before returning.
+//
+// Siblings are always latched left to right. With the parent held
+// nobody else can reach the node, so it is let go while its left
+// sibling is latched. For the same reason nobody can be waiting on a
+// node that is merged away.
+template <typename Tree>
+void concurrent_fix_underflow(Tree &tree, typename Tree::node_type *parent,
+                              int slot) {
+  using Node = typename Tree::node_type;
+  Node *node = parent->children[slot];
+  if (slot > 0) {
+    Node *left = parent->children[slot - 1];
+    node->latch.unlock();
+    left->latch.lock();
+    node->latch.lock();
+    bool borrow = left->num_keys > Node::min_keys;
+    if (borrow) {
+      node_borrow_left(parent, slot, left, node);
+    } else {
+      node_merge(parent, slot - 1, left, node);
+    }
+    left->latch.unlock();
+    if (borrow) {
+      node->latch.unlock();
+    } else {
+      retire_node(tree, node);
+    }
+  } else {
+    Node *right = parent->children[1];
+    right->latch.lock();
+    bool borrow = right->num_keys > Node::min_keys;
+    if (borrow) {
+      node_borrow_right(parent, slot, node, right);
+    } else {
+      node_merge(parent, slot, node, right);
+    }
+    if (borrow) {
+      right->latch.unlock();
+    } else {
+      retire_node(tree, right);
+    }
+    node->latch.unlock();
+  }
+}
+
+// Reads field of a node in an optimistic tree, which a writer may be
+// storing to at the same time.
+template <typename T> T optimistic_load(T &field) {
+  return atomic_ref<T>(field).load(memory_order_relaxed);
+}
+
+// search_keys for an optimistic reader: a binary search over node's
+// keys that loads each key, and the count, with optimistic_load. Sets
+// found if the key at the returned index is key.
+template <typename Node>
+int optimistic_search(Node *node, const typename Node::key_type &key,
+                      bool &found) {
+  int lo = 0;
+  int hi = optimistic_load(node->num_keys);
+  int n = hi;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (optimistic_load(node->keys[mid]) < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  found = lo < n && optimistic_load(node->keys[lo]) == key;
+  return lo;
+}
+
+// Goes down an optimistic tree to the leaf key belongs in without
+// writing anything, and returns it with its version in version, or
+// nullptr if the tree is empty. Sets restart (and returns nullptr) if
+// a writer got in the way.
+template <typename Tree>
+typename Tree::node_type *
+optimistic_leaf(Tree &tree, const typename Tree::key_type &key,
+                uint64_t &version, bool &restart) {
+  using Node = typename Tree::node_type;
+  uint64_t root_version = tree.root_latch.read_lock(restart);
+  Node *node = tree.root.load(memory_order_acquire);
+  if (node == nullptr) {
+    tree.root_latch.validate(root_version, restart);
+    return nullptr;
+  }
+  uint64_t v = node->latch.read_lock(restart);
+  tree.root_latch.validate(root_version, restart);
+  if (restart) {
+    return nullptr;
+  }
+
+  while (!node->is_leaf) {
+    bool found;
+    int slot = optimistic_search(node, key, found);
+    Node *child = optimistic_load(node->children[slot + found]);
+    node->latch.validate(v, restart);
+    if (restart) {
+      return nullptr;
+    }
+    uint64_t child_version = child->latch.read_lock(restart);
+    // The child may have split after we read its pointer, leaving key
+    // in its new sibling.
+    node->latch.validate(v, restart);
+    if (restart) {
+      return nullptr;
+    }
+    node = child;
+    v = child_version;
+  }
+  version = v;
+  return node;
+}
+
+// lock_leaf for an optimistic tree: goes down without latches and takes
+// the leaf's latch only if it hasn't changed since it was read.
+template <typename Tree>
+typename Tree::node_type *
+optimistic_lock_leaf(Tree &tree, const typename Tree::key_type &key) {
+  using Node = typename Tree::node_type;
+  while (true) {
+    bool restart = false;
+    uint64_t version;
+    Node *leaf = optimistic_leaf(tree, key, version, restart);
+    if (!restart && (leaf == nullptr || leaf->latch.try_upgrade(version))) {
+      return leaf;
+    }
+  }
+}
+
+// Goes down to the leaf key belongs in holding shared latches (or, in
+// an optimistic tree, none), and returns the leaf latched exclusively,
+// or nullptr if the tree is empty.
+template <typename Key, int Order, bool Optimistic>
+typename concurrent_btree<Key, Order, Optimistic>::node_type *
+lock_leaf(concurrent_btree<Key, Order, Optimistic> &tree, const Key &key) {
+  using Node = typename concurrent_btree<Key, Order, Optimistic>::node_type;
+  if constexpr (Optimistic) {
+    return optimistic_lock_leaf(tree, key);
+  } else {
+    tree.root_latch.lock_shared();
+    Node *node = tree.root;
+    if (node == nullptr) {
+      tree.root_latch.unlock_shared();
+      return nullptr;
+    }
+    if (node->is_leaf) {
+      node->latch.lock();
+    } else {
+      node->latch.lock_shared();
+    }
+    tree.root_latch.unlock_shared();
+
+    while (!node->is_leaf) {
+      Node *child = node->children[child_slot(node, key)];
+      if (child->is_leaf) {
+        child->latch.lock();
+      } else {
+        child->latch.lock_shared();
+      }
+      node->latch.unlock_shared();
+      node = child;
+    }
+    return node;
+  }
+}
+
+// Goes down to the leaf key belongs in taking exclusive latches,
+// creating a root leaf if the tree is empty. Once a node is safe(node,
+// is_root), the latches above it are let go. Returns the leaf; path
+// holds the latched nodes above it, and root_locked says whether
+// root_latch is still held.
+template <typename Tree, typename Safe>
+typename Tree::node_type *
+lock_path(Tree &tree, const typename Tree::key_type &key,
+          btree_path<typename Tree::node_type> &path, bool &root_locked,
+          Safe safe) {
+  using Node = typename Tree::node_type;
+  tree.root_latch.lock();
+  root_locked = true;
+  if (tree.root == nullptr) {
+    tree.root = new Node(true);
+  }
+  Node *node = tree.root;
+  node->latch.lock();
+  if (safe(node, true)) {
+    tree.root_latch.unlock();
+    root_locked = false;
+  }
+
+  path.depth = 0;
+  while (!node->is_leaf) {
+    int slot = child_slot(node, key);
+    Node *child = node->children[slot];
+    child->latch.lock();
+    path.push(node, slot);
+    if (safe(child, false)) {
+      for (int i = 0; i < path.depth; i++) {
+        path.nodes[i]->latch.unlock();
+      }
+      path.depth = 0;
+      if (root_locked) {
+        tree.root_latch.unlock();
+        root_locked = false;
+      }
+    }
+    node = child;
+  }
+  return node;
+}
+
+// Lets go of everything lock_path left latched
+template <typename Tree>
+void unlock_path(Tree &tree, btree_path<typename Tree::node_type> &path,
+                 typename Tree::node_type *leaf, bool root_locked) {
+  leaf->latch.unlock();
+  for (int i = 0; i < path.depth; i++) {
+    path.nodes[i]->latch.unlock();
+  }
+  if (root_locked) {
+    tree.root_latch.unlock();
+  }
+}
+
+// contains for an optimistic tree, which latches nothing
+template <typename Tree>
+bool optimistic_contains(Tree &tree, const typename Tree::key_type &key) {
+  using Node = typename Tree::node_type;
+  while (true) {
+    bool restart = false;
+    uint64_t version;
+    Node *leaf = optimistic_leaf(tree, key, version, restart);
+    if (restart) {
+      continue;
+    }
+    if (leaf == nullptr) {
+      return false;
+    }
+    bool found;
+    optimistic_search(leaf, key, found);
+    leaf->latch.validate(version, restart);
+    if (!restart) {
+      return found;
+    }
+  }
+}
+
+// contains returns whether key is in the tree.
+template <typename Key, int Order, bool Optimistic>
+bool contains(concurrent_btree<Key, Order, Optimistic> &tree,
+              const typename nondeduced<Key>::type &key) {
+  using Node = typename concurrent_btree<Key, Order, Optimistic>::node_type;
+  typename concurrent_btree<Key, Order, Optimistic>::guard_type guard(
+      tree.reclaimer);
+  if constexpr (Optimistic) {
+    return optimistic_contains(tree, key);
+  } else {
+    tree.root_latch.lock_shared();
+    Node *node = tree.root;
+    if (node == nullptr) {
+      tree.root_latch.unlock_shared();
+      return false;
+    }
+    node->latch.lock_shared();
+    tree.root_latch.unlock_shared();
+
+    while (!node->is_leaf) {
+      Node *child = node->children[child_slot(node, key)];
+      child->latch.lock_shared();
+      node->latch.unlock_shared();
+      node = child;
+    }
+    int idx = search_keys(node->keys.data(), node->num_keys, key);
+    bool found = idx < node->num_keys && node->keys[idx] == key;
+    node->latch.unlock_shared();
+    return found;
+  }
+}
+
+// insert adds key to the tree, returning whether it wasn't there yet.
+template <typename Key, int Order, bool Optimistic>
+bool insert(concurrent_btree<Key, Order, Optimistic> &tree,
+            const typename nondeduced<Key>::type &key) {
+  using Node = typename concurrent_btree<Key, Order, Optimistic>::node_type;
+  typename concurrent_btree<Key, Order, Optimistic>::guard_type guard(
+      tree.reclaimer);
+
+  Node *leaf = lock_leaf(tree, key);
+  if (leaf != nullptr) {
+    int idx = search_keys(leaf->keys.data(), leaf->num_keys, key);
+    if (idx < leaf->num_keys && leaf->keys[idx] == key) {
+      leaf->latch.unlock();
+      return false;
+    }
+    if (leaf->num_keys < Node::max_keys) {
+      node_insert_at(leaf, idx, key);
+      tree.key_count++;
+      leaf->latch.unlock();
+      return true;
+    }
+    leaf->latch.unlock();
+  }
+
+  // The leaf is full: start over, holding every node a split could
+  // reach.
+  btree_path<Node> path;
+  bool root_locked;
+  Node *node = lock_path(tree, key, path, root_locked, [](Node *node, bool) {
+    return node->num_keys < Node::max_keys;
+  });
+  int idx = search_keys(node->keys.data(), node->num_keys, key);
+  if (idx < node->num_keys && node->keys[idx] == key) {
+    unlock_path(tree, path, node, root_locked);
+    return false;
+  }
+  node_insert_at(node, idx, key);
+  tree.key_count++;
+
+  while (path.depth > 0) {
+    path.depth--;
+    Node *parent = path.nodes[path.depth];
+    if (node->num_keys > Node::max_keys) {
+      concurrent_split(parent, path.slots[path.depth]);
+    }
+    node->latch.unlock();
+    node = parent;
+  }
+  if (node->num_keys > Node::max_keys) {
+    assert(root_locked);
+    Node *root = new Node(false);
+    root->children[0] = node;
+    concurrent_split(root, 0);
+    tree.root = root;
+  }
+  node->latch.unlock();
+  if (root_locked) {
+    tree.root_latch.unlock();
+  }
+  return true;
+}
+
+// remove deletes key from the tree, returning whether it was there.
+template <typename Key, int Order, bool Optimistic>
+bool remove(concurrent_btree<Key, Order, Optimistic> &tree,
+            const typename nondeduced<Key>::type &key) {
+  using Node = typename concurrent_btree<Key, Order, Optimistic>::node_type;
+  typename concurrent_btree<Key, Order, Optimistic>::guard_type guard(
+      tree.reclaimer);
+
+  Node *leaf = lock_leaf(tree, key);
+  if (leaf == nullptr) {
+    return false;
+  }
+  int idx = search_keys(leaf->keys.data(), leaf->num_keys, key);
+  if (idx == leaf->num_keys || !(leaf->keys[idx] == key)) {
+    leaf->latch.unlock();
+    return false;
+  }
+  if (leaf->num_keys > Node::min_keys) {
+    node_remove_at(leaf, idx);
+    tree.key_count--;
+    leaf->latch.unlock();
+    return true;
+  }
+  leaf->latch.unlock();
+
+  // The leaf could underflow: start over, holding every node a merge
+  // could reach. A root leaf can go down to no keys; an internal root
+  // is only safe if it won't be left with a single child.
+  btree_path<Node> path;
+  bool root_locked;
+  Node *node =
+      lock_path(tree, key, path, root_locked, [](Node *node, bool is_root) {
+        if (is_root) {
+          return node->is_leaf || node->num_keys > 1;
+        }
+        return node->num_keys > Node::min_keys;
+      });
+  idx = search_keys(node->keys.data(), node->num_keys, key);
+  if (idx == node->num_keys || !(node->keys[idx] == key)) {
+    unlock_path(tree, path, node, root_locked);
+    return false;
+  }
+  node_remove_at(node, idx);
+  tree.key_count--;
+
+  while (path.depth > 0) {
+    path.depth--;
+    Node *parent = path.nodes[path.depth];
+    if (node->num_keys < Node::min_keys) {
+      concurrent_fix_underflow(tree, parent, path.slots[path.depth]);
+    } else {
+      node->latch.unlock();
+    }
+    node = parent;
+  }
+  if (!node->is_leaf && node->num_keys == 0) {
+    assert(root_locked);
+    tree.root = node->children[0];
+    retire_node(tree, node);
+  } else {
+    node->latch.unlock();
+  }
+  if (root_locked) {
+    tree.root_latch.unlock();
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,255 @@
+// btree_epoch.h
+//
+// epoch_reclaimer frees nodes that have been taken out of a concurrent
+// tree once no thread can still be looking at them, without readers
+// having to count references to every node they pass.
+//
+// A thread reading the tree without latches does so inside an
+// epoch_guard, which announces the global epoch it saw on the way in
+// and withdraws the announcement on the way out. A node unlinked from
+// the tree is handed to retire, which tags it with the epoch at that
+// moment. The epoch only moves on once every thread inside a guard has
+// announced the current one, so once it is two past a node's tag, every
+// thread still inside started after the node was unlinked and can't
+// reach it, and the node is freed.
+//
+// Each thread that uses a reclaimer claims a slot for its announcements.
+// When the thread exits it hands the slot back, and the next thread to
+// come along claims it instead of adding another, so the list is only
+// as long as the most threads that have used the reclaimer at once.
+// Retiring is rare next to reading, so the retired nodes wait on one
+// list behind a mutex.
+
+#ifndef btree_epoch_h
+#define btree_epoch_h
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <set>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+class epoch_reclaimer {
+public:
+  epoch_reclaimer() : id(next_id.fetch_add(1)) {
+    lock_guard<mutex> hold(live_latch);
+    live.insert(id);
+  }
+  epoch_reclaimer(const epoch_reclaimer &) = delete;
+  epoch_reclaimer &operator=(const epoch_reclaimer &) = delete;
+
+  // Nobody can be inside a guard any more, so whatever is left goes.
+  ~epoch_reclaimer() {
+    {
+      // After this no exiting thread will touch the slots.
+      lock_guard<mutex> hold(live_latch);
+      live.erase(id);
+    }
+    for (retired &r : limbo) {
+      r.free(r.ptr);
+    }
+    for (slot *s = slots.load(); s != nullptr;) {
+      slot *next = s->next;
+      delete s;
+      s = next;
+    }
+  }
+
+  // Frees node (with delete) once no thread inside a guard can reach
+  // it. The caller must already have unlinked it from the tree.
+  template <typename T> void retire(T *node) {
+    lock_guard<mutex> hold(limbo_latch);
+    limbo.push_back({node, [](void *ptr) { delete static_cast<T *>(ptr); },
+                     epoch.load()});
+    collect();
+  }
+
+  // retired_count is the number of nodes waiting to be freed.
+  size_t retired_count() {
+    lock_guard<mutex> hold(limbo_latch);
+    return limbo.size();
+  }
+
+  // current_epoch is the global epoch, which only goes up.
+  uint64_t current_epoch() const { return epoch.load(); }
+
+  // slot_count is the number of slots threads have added, in use or
+  // not.
+  size_t slot_count() const {
+    size_t n = 0;
+    for (slot *s = slots.load(); s != nullptr; s = s->next) {
+      n++;
+    }
+    return n;
+  }
+
+  // cached_slots is the number of reclaimers the calling thread holds a
+  // slot in, counting any that have gone but that it hasn't yet noticed.
+  static size_t cached_slots() { return my_slots().entries.size(); }
+
+private:
+  friend class epoch_guard;
+
+  static constexpr uint64_t idle = numeric_limits<uint64_t>::max();
+
+  // A thread's announcement: the epoch it entered its guard in, or idle.
+  // in_use is set while a thread has claimed the slot.
+  struct alignas(64) slot {
+    atomic<uint64_t> epoch{idle};
+    atomic<bool> in_use{true};
+    slot *next = nullptr;
+  };
+
+  // The slots a thread has claimed, by reclaimer id. When the thread
+  // exits it hands back those whose reclaimers are still live.
+  struct thread_slots {
+    vector<pair<uint64_t, slot *>> entries;
+
+    ~thread_slots() {
+      lock_guard<mutex> hold(live_latch);
+      for (auto &entry : entries) {
+        if (live.count(entry.first) != 0) {
+          entry.second->in_use.store(false, memory_order_release);
+        }
+      }
+    }
+  };
+
+  static thread_slots &my_slots() {
+    thread_local thread_slots mine;
+    return mine;
+  }
+
+  struct retired {
+    void *ptr;
+    void (*free)(void *);
+    uint64_t epoch;
+  };
+
+  // Returns the calling thread's slot, claiming one the first time:
+  // one an exited thread handed back if there is one, or else a new
+  // one. Each thread caches its slots by reclaimer id, which is never
+  // reused; the first time it claims a slot it also drops the entries
+  // of reclaimers that have gone.
+  slot *my_slot() {
+    vector<pair<uint64_t, slot *>> &mine = my_slots().entries;
+    for (auto &entry : mine) {
+      if (entry.first == id) {
+        return entry.second;
+      }
+    }
+    {
+      lock_guard<mutex> hold(live_latch);
+      size_t kept = 0;
+      for (auto &entry : mine) {
+        if (live.count(entry.first) != 0) {
+          mine[kept++] = entry;
+        }
+      }
+      mine.resize(kept);
+    }
+
+    slot *s = slots.load();
+    for (; s != nullptr; s = s->next) {
+      bool in_use = false;
+      if (s->in_use.compare_exchange_strong(in_use, true,
+                                            memory_order_acquire)) {
+        break;
+      }
+    }
+    if (s == nullptr) {
+      s = new slot;
+      s->next = slots.load();
+      while (!slots.compare_exchange_weak(s->next, s)) {
+      }
+    }
+    mine.emplace_back(id, s);
+    return s;
+  }
+
+  // Moves the epoch on if every thread inside a guard has caught up with
+  // it, then frees what was retired two or more epochs ago. The caller
+  // holds limbo_latch.
+  void collect() {
+    uint64_t now = epoch.load();
+    bool caught_up = true;
+    for (slot *s = slots.load(); s != nullptr; s = s->next) {
+      uint64_t e = s->epoch.load();
+      if (e != idle && e != now) {
+        caught_up = false;
+        break;
+      }
+    }
+    if (caught_up && epoch.compare_exchange_strong(now, now + 1)) {
+      now++;
+    }
+
+    size_t kept = 0;
+    for (retired &r : limbo) {
+      if (r.epoch + 2 <= now) {
+        r.free(r.ptr);
+      } else {
+        limbo[kept++] = r;
+      }
+    }
+    limbo.resize(kept);
+  }
+
+  static inline atomic<uint64_t> next_id{0};
+
+  // The ids of the reclaimers that haven't been destroyed yet
+  static inline mutex live_latch;
+  static inline set<uint64_t> live;
+
+  const uint64_t id;
+  atomic<uint64_t> epoch{0};
+  atomic<slot *> slots{nullptr};
+  mutex limbo_latch;
+  vector<retired> limbo;
+};
+
+// epoch_guard marks the calling thread as inside reclaimer for its
+// lifetime: nothing retired while it lives is freed until it is gone.
+// Guards on one thread don't nest.
+class epoch_guard {
+public:
+  explicit epoch_guard(epoch_reclaimer &reclaimer)
+      : announced(reclaimer.my_slot()->epoch) {
+    assert(announced.load(memory_order_relaxed) == epoch_reclaimer::idle);
+    // The epoch may move on between reading and announcing it; announce
+    // again until the announcement is current, so collect can't have
+    // missed it.
+    uint64_t e = reclaimer.epoch.load();
+    while (true) {
+      announced.store(e);
+      uint64_t now = reclaimer.epoch.load();
+      if (now == e) {
+        break;
+      }
+      e = now;
+    }
+  }
+  epoch_guard(const epoch_guard &) = delete;
+  epoch_guard &operator=(const epoch_guard &) = delete;
+  ~epoch_guard() {
+    announced.store(epoch_reclaimer::idle, memory_order_release);
+  }
+
+private:
+  atomic<uint64_t> &announced;
+};
+
+// no_reclaimer and no_epoch_guard stand in for epoch_reclaimer and
+// epoch_guard where nothing needs them.
+struct no_reclaimer {};
+
+struct no_epoch_guard {
+  explicit no_epoch_guard(no_reclaimer &) {}
+};
+
+#endif
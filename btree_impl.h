@@ -0,0 +1,1455 @@
+// btree_impl.h
+//
+// Template definitions for the operations declared in btree.h. This
+// file is included at the bottom of btree.h; don't include it directly.
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "btree_search.h"
+
+using namespace std;
+
+// Initializes a btree node in the tree's arenas
+template <typename Tree>
+typename Tree::node_type *init(Tree &tree, bool is_leaf) {
+  return is_leaf ? tree.new_leaf() : tree.new_internal();
+}
+
+// Reports a structural change to the tree's debug hook, if it has one.
+// Without BTREE_DEBUG_HOOKS this compiles to nothing.
+template <typename Tree, typename Node>
+void debug_event(Tree &tree, btree_event event, Node *node) {
+#if BTREE_DEBUG_HOOKS
+  if (tree.debug_hook) {
+    tree.debug_hook(event, node);
+  }
+#else
+  (void)tree;
+  (void)event;
+  (void)node;
+#endif
+}
+
+// Brings the node's search index up to date after its keys change
+template <typename Node>
+void reindex(Node *node) {
+  Node::search_type::rebuild(node->index, node->keys.data(), node->num_keys);
+}
+
+// Moves the value that goes with from->keys[from_idx] into
+// to->values[to_idx]. Sets have no values, so for them it does nothing,
+// as does reset_value.
+template <typename Node>
+void move_value(Node *from, int from_idx, Node *to, int to_idx) {
+  if constexpr (Node::is_map) {
+    to->values[to_idx] = std::move(from->values[from_idx]);
+  }
+}
+
+// Puts a default value in the slot, freeing whatever was there
+template <typename Node>
+void reset_value(Node *node, int idx) {
+  if constexpr (Node::is_map) {
+    node->values[idx] = typename Node::mapped_type();
+  }
+}
+
+// Overwrites the key (and value) at the index idx in the node with the
+// one at from_idx in 'from'
+template <typename Node>
+void set_entry(Node *node, int idx, Node *from, int from_idx) {
+  node->keys[idx] = from->keys[from_idx];
+  move_value(from, from_idx, node, idx);
+  reindex(node);
+}
+
+// Overwrites a B+ tree separator key. Separators have no values.
+template <typename Node>
+void set_separator(Node *node, int idx, const typename Node::key_type &key) {
+  node->keys[idx] = key;
+  reindex(node);
+}
+
+// Inserts a key at the index idx in the node. In a map it gets a
+// default value.
+template <typename Node>
+void insert_key_at(Node *&node, const typename Node::key_type &key, int idx) {
+  int no_keys = node->num_keys;
+
+  for (int i = no_keys - 1; i >= idx; i--) {
+    node->keys[i + 1] = node->keys[i];
+    move_value(node, i, node, i + 1);
+  }
+
+  node->keys[idx] = key;
+  reset_value(node, idx);
+  node->num_keys++;
+  reindex(node);
+}
+
+// Inserts the key (and value) at from_idx in 'from' at the index idx
+// in the node
+template <typename Node>
+void insert_entry_at(Node *node, int idx, Node *from, int from_idx) {
+  insert_key_at(node, from->keys[from_idx], idx);
+  move_value(from, from_idx, node, idx);
+}
+
+//Remove a key at the index idx from the node
+template <typename Node>
+void remove_key_at(Node *&node, int idx) {
+  for (int i = idx + 1; i < node->num_keys; i++) {
+    node->keys[i - 1] = node->keys[i];
+    move_value(node, i, node, i - 1);
+  }
+
+  node->num_keys--;
+  reset_value(node, node->num_keys);
+  reindex(node);
+}
+
+// Returns the summary of every key in the subtree at node, from its
+// own keys and its children's summaries. B+ tree separators are only
+// copies, so they don't count.
+template <typename Node>
+typename Node::summary_type::type summarize(Node *node) {
+  using Summary = typename Node::summary_type;
+
+  typename Summary::type total = Summary::empty();
+  for (int i = 0; i < node->num_keys; i++) {
+    if (!node->is_leaf) {
+      total = Summary::combine(total, node->summary(i));
+    }
+    if (node->is_leaf || !Node::is_bplus) {
+      total = Summary::combine(total, Summary::entry(node, i));
+    }
+  }
+  if (!node->is_leaf) {
+    total = Summary::combine(total, node->summary(node->num_keys));
+  }
+  return total;
+}
+
+// Brings the summary of parent->child(slot) up to date after the child
+// changes. Trees without summaries have nothing to update.
+template <typename Node>
+void update_summary(Node *parent, int slot) {
+  if constexpr (Node::is_summarized) {
+    parent->summary(slot) = summarize(parent->child(slot));
+  }
+}
+
+// Moves from->child(from_idx), and its summary, to to->child(to_idx)
+template <typename Node>
+void move_child(Node *from, int from_idx, Node *to, int to_idx) {
+  to->child(to_idx) = from->child(from_idx);
+  if constexpr (Node::is_summarized) {
+    to->summary(to_idx) = from->summary(from_idx);
+  }
+}
+
+// Brings the summaries along a path up to date, from the bottom up
+template <typename Node, int MaxDepth>
+void update_summaries(btree_path<Node, MaxDepth> &path) {
+  while (path.depth > 0) {
+    path.depth--;
+    update_summary(path.nodes[path.depth], path.slots[path.depth]);
+  }
+}
+
+// Inserts a child at the index. The separator key for the new child
+// has already been inserted, so only num_keys children are in place.
+// The caller brings its summary up to date.
+template <typename Node>
+void insert_child_at(Node *&node, Node *&child, int idx) {
+  int no_children = node->num_keys;
+
+  for (int i = no_children - 1; i >= idx; i--) {
+    move_child(node, i, node, i + 1);
+  }
+
+  node->child(idx) = child;
+}
+
+// Move keys from the left node to the right node
+template <typename Node>
+void move_keys(Node *left, Node *right, int start) {
+  int idx = 0;
+
+  for (int i = start; i < left->num_keys; i++) {
+    move_value(left, i, right, idx);
+    right->keys[idx++] = left->keys[i];
+    right->num_keys++;
+  }
+  reindex(right);
+}
+
+// Move children from the left node to the right node
+template <typename Node>
+void move_children(Node *left, Node *right, int start_idx, int total_children) {
+
+  int idx = 0;
+  for (int i = start_idx; i < total_children; i++) {
+    move_child(left, i, right, idx++);
+    left->child(i) = nullptr;
+  }
+}
+
+// Clear keys in a node
+template <typename Node>
+void clear_keys(Node *node, int from_idx) {
+  assert(from_idx < Node::order + 1);
+
+  for (int i = from_idx; i < node->num_keys; i++) {
+    node->keys[i] = typename Node::key_type();
+    reset_value(node, i);
+  }
+
+  node->num_keys = from_idx;
+  reindex(node);
+}
+
+//Remove a child at idx from the node
+template <typename Node>
+void remove_child_at(Node *&node, int idx) {
+  for (int i = idx + 1; i < Node::order + 1; i++) {
+    move_child(node, i, node, i - 1);
+  }
+  node->child(Node::order) = nullptr;
+}
+
+// Returns the index of key in the node, or the index where it can be
+// inserted if it isn't there, using the tree's search policy.
+template <typename Node>
+int find_idx(const Node *node, const typename Node::key_type &target) {
+  return Node::search_type::search(node->index, node->keys.data(),
+                                   node->num_keys, target);
+}
+
+// Links the new B+ tree leaf 'right' into the leaf chain just after
+// 'left'
+template <typename Node>
+void link_leaf_after(Node *left, Node *right) {
+  right->prev_leaf() = left;
+  right->next_leaf() = left->next_leaf();
+  if (right->next_leaf() != nullptr) {
+    right->next_leaf()->prev_leaf() = right;
+  }
+  left->next_leaf() = right;
+}
+
+// Takes a B+ tree leaf that is about to be freed out of the leaf chain
+template <typename Node>
+void unlink_leaf(Node *leaf) {
+  if (leaf->prev_leaf() != nullptr) {
+    leaf->prev_leaf()->next_leaf() = leaf->next_leaf();
+  }
+  if (leaf->next_leaf() != nullptr) {
+    leaf->next_leaf()->prev_leaf() = leaf->prev_leaf();
+  }
+}
+
+// Splits parent->child(slot), which has gone one key over max_keys,
+// in two around its middle key. The middle key moves up into the
+// parent at slot, with the new right half as the child after it.
+//
+// A B+ tree leaf keeps all of its keys instead: the right half starts
+// at the middle key, a copy of which goes up as the separator, and the
+// new leaf is linked into the chain after the old one.
+//
+// at_end splits off just the last key instead, for a node on the right
+// edge of the tree that overflowed because a key was appended. The
+// left node stays (all but) full; appends fill the right one next.
+template <typename Tree, typename Node>
+void split_child(Tree &tree, Node *parent, int slot, bool at_end = false) {
+  Node *left = parent->child(slot);
+  Node *right = init(tree, left->is_leaf);
+
+  int mid = left->num_keys / 2;
+  if (at_end) {
+    mid = left->num_keys - (Node::is_bplus && left->is_leaf ? 1 : 2);
+  }
+  if (Node::is_bplus && left->is_leaf) {
+    move_keys(left, right, mid);
+    clear_keys(left, mid);
+    insert_key_at(parent, right->keys[0], slot);
+    insert_child_at(parent, right, slot + 1);
+    if constexpr (Node::is_bplus) {
+      link_leaf_after(left, right);
+    }
+  } else {
+    insert_entry_at(parent, slot, left, mid);
+    insert_child_at(parent, right, slot + 1);
+
+    // left keeps the children on either side of its remaining mid keys
+    if (!left->is_leaf) {
+      move_children(left, right, mid + 1, left->num_keys + 1);
+    }
+    move_keys(left, right, mid + 1);
+    clear_keys(left, mid);
+  }
+
+  update_summary(parent, slot);
+  update_summary(parent, slot + 1);
+  debug_event(tree, btree_event::split, left);
+}
+
+// Splits an overfull root under a new root, making the tree one level
+// taller.
+template <typename Tree>
+void grow_root(Tree &tree, bool at_end = false) {
+  typename Tree::node_type *root = init(tree, false);
+  root->child(0) = tree.root;
+  tree.root = root;
+
+  split_child(tree, root, 0, at_end);
+  debug_event(tree, btree_event::new_root, root);
+}
+
+template <typename Node>
+bool btree_finger<Node>::covers(const Node *root,
+                                const typename Node::key_type &key) const {
+  if (path.depth == 0 || path.nodes[0] != root) {
+    return false;
+  }
+
+  // In a B+ tree the lower separator is the leaf's own first key (or
+  // below it), so key may equal it.
+  bool low_found = false;
+  bool high_found = false;
+  for (int i = path.depth - 2; i >= 0 && !(low_found && high_found); i--) {
+    const Node *node = path.nodes[i];
+    int slot = path.slots[i];
+    if (!low_found && slot > 0) {
+      const typename Node::key_type &low = node->keys[slot - 1];
+      if (Node::is_bplus ? key < low : !(low < key)) {
+        return false;
+      }
+      low_found = true;
+    }
+    if (!high_found && slot < node->num_keys) {
+      if (!(key < node->keys[slot])) {
+        return false;
+      }
+      high_found = true;
+    }
+  }
+  return true;
+}
+
+// Points finger at the rightmost leaf of the tree at root, going down
+// the last child of each node
+template <typename Node>
+void aim_at_right_edge(btree_finger<Node> &finger, Node *root) {
+  finger.path.depth = 0;
+  Node *node = root;
+  while (!node->is_leaf) {
+    finger.path.push(node, node->num_keys);
+    node = node->child(node->num_keys);
+  }
+  finger.path.push(node, node->num_keys);
+}
+
+// Copies the first depth entries of one path into another
+template <typename Node, int MaxDepth>
+void copy_path(btree_path<Node, MaxDepth> &to,
+               const btree_path<Node, MaxDepth> &from, int depth) {
+  to.depth = 0;
+  for (int i = 0; i < depth; i++) {
+    to.push(from.nodes[i], from.slots[i]);
+  }
+}
+
+// Finds key in the tree, adding it if it isn't there, and calls
+// place(node, idx, inserted) on its slot. That happens before any
+// split moves the key, so place can fill in the value. Returns whether
+// the key was added.
+//
+// In a B+ tree a separator equal to the key only says the key is in
+// the subtree to its right, so the walk goes on down to a leaf.
+//
+// If finger is given and covers the key, the walk starts at its leaf.
+// It is left at the leaf the key went into, or empty if a split moved
+// things around under it.
+//
+// A key bigger than any in the tree is an append. The tree keeps the
+// path to its rightmost leaf in tree.tail, so a run of appends starts
+// there rather than at the root, and the nodes an append overfills
+// are split at the end (see split_child), so that increasing keys
+// leave full nodes behind them rather than half-full ones.
+template <typename Tree, typename Place>
+bool insert_with(Tree &tree, const typename Tree::key_type &key, Place place,
+                 typename Tree::finger *finger = nullptr) {
+  using Node = typename Tree::node_type;
+
+  if (tree.root == nullptr) {
+    tree.root = init(tree, true);
+  }
+
+  // Walk down to the leaf the key belongs in, remembering the way.
+  // Each level is searched once.
+  btree_path<Node> path;
+  Node *node = tree.root;
+  bool from_finger = finger != nullptr && finger->covers(tree.root, key);
+  if (from_finger) {
+    copy_path(path, finger->path, finger->path.depth - 1);
+    node = finger->leaf();
+  } else if (tree.tail.covers(tree.root, key)) {
+    copy_path(path, tree.tail.path, tree.tail.path.depth - 1);
+    node = tree.tail.leaf();
+  }
+  bool append = false;
+  while (true) {
+    int pos_idx = find_idx(node, key);
+    if (pos_idx < node->num_keys && node->keys[pos_idx] == key) {
+      if (node->is_leaf || !Node::is_bplus) {
+        if (finger != nullptr && node->is_leaf && !from_finger) {
+          copy_path(finger->path, path, path.depth);
+          finger->path.push(node, pos_idx);
+        }
+        // place may have changed the value, which a map's summaries
+        // can depend on.
+        place(node, pos_idx, false);
+        if (Node::is_map && Node::is_summarized) {
+          update_summaries(path);
+        }
+        return false;
+      }
+      pos_idx++;
+    }
+
+    if (node->is_leaf) {
+      append = pos_idx == node->num_keys;
+      for (int i = 0; append && i < path.depth; i++) {
+        append = path.slots[i] == path.nodes[i]->num_keys;
+      }
+      insert_key_at(node, key, pos_idx);
+      place(node, pos_idx, true);
+      tree.key_count++;
+      if (finger != nullptr && !from_finger) {
+        copy_path(finger->path, path, path.depth);
+        finger->path.push(node, pos_idx);
+      }
+      break;
+    }
+    path.push(node, pos_idx);
+    node = node->child(pos_idx);
+  }
+
+  // A split moves nodes around under the fingers, so they are re-aimed
+  // or dropped below.
+  bool split = node->num_keys > Node::max_keys;
+
+  // Walk back up splitting overfull nodes. The path says where each
+  // one hangs off its parent, so the separator goes straight in. Once
+  // a node has room the rest of the path is done with, unless it keeps
+  // summaries that now need updating.
+  while (path.depth > 0) {
+    path.depth--;
+    Node *parent = path.nodes[path.depth];
+    int slot = path.slots[path.depth];
+    if (node->num_keys > Node::max_keys) {
+      split_child(tree, parent, slot, append);
+    } else if (Node::is_summarized) {
+      update_summary(parent, slot);
+    } else {
+      break;
+    }
+    node = parent;
+  }
+  if (node->num_keys > Node::max_keys) {
+    grow_root(tree, append);
+  }
+
+  if (append) {
+    if (split || tree.tail.path.depth == 0) {
+      aim_at_right_edge(tree.tail, tree.root);
+    }
+    if (finger != nullptr && split) {
+      *finger = tree.tail;
+    }
+  } else if (split) {
+    tree.tail.path.depth = 0;
+    if (finger != nullptr) {
+      finger->path.depth = 0;
+    }
+  }
+  return true;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+void insert(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+            const typename nondeduced<Key>::type &key) {
+  insert_with(tree, key, [](auto *, int, bool) {});
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool insert_near(
+    btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+    typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::finger
+        &hint,
+    const typename nondeduced<Key>::type &key) {
+  return insert_with(tree, key, [](auto *, int, bool) {}, &hint);
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool insert_or_assign(
+    btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+    const typename nondeduced<Key>::type &key,
+    typename nondeduced<Value>::type value) {
+  static_assert(!is_void<Value>::value, "insert_or_assign needs a map");
+  return insert_with(tree, key, [&](auto *node, int idx, bool) {
+    node->values[idx] = std::move(value);
+  });
+}
+
+// Inserts keys from the sorted batch starting at 'next' into the
+// subtree at node, for as long as they are below *upper (no limit if
+// upper is null) and node has room. A node is allowed to go one key
+// over max_keys, as in insert; the caller splits it and calls
+// back in for the rest of the batch.
+template <typename Tree, typename Node, typename Iter>
+void insert_batch_helper(Tree &tree, Node *node, Iter &next, Iter last,
+                         const typename Node::key_type *upper) {
+  while (next != last && (upper == nullptr || *next < *upper) &&
+         node->num_keys <= Node::max_keys) {
+    int pos_idx = find_idx(node, *next);
+    if (pos_idx < node->num_keys && node->keys[pos_idx] == *next) {
+      if (node->is_leaf || !Node::is_bplus) {
+        ++next;
+        continue;
+      }
+      pos_idx++;
+    }
+
+    if (node->is_leaf) {
+      insert_key_at(node, *next, pos_idx);
+      tree.key_count++;
+      ++next;
+      continue;
+    }
+
+    // The keys below the separator at pos_idx all belong to this child.
+    const typename Node::key_type *child_upper =
+        pos_idx < node->num_keys ? &node->keys[pos_idx] : upper;
+    Node *child = node->child(pos_idx);
+    insert_batch_helper(tree, child, next, last, child_upper);
+
+    if (child->num_keys > Node::max_keys) {
+      split_child(tree, node, pos_idx);
+    } else {
+      update_summary(node, pos_idx);
+    }
+  }
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary, typename Iter>
+void insert_batch(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+                  Iter first, Iter last) {
+  using Node = btree<Key, Order, Search, Value, BPlus, Summary>;
+
+  tree.tail.path.depth = 0;
+  vector<Key> batch(first, last);
+  sort(batch.begin(), batch.end());
+  batch.erase(unique(batch.begin(), batch.end()), batch.end());
+
+  if (tree.root == nullptr && !batch.empty()) {
+    tree.root = init(tree, true);
+  }
+
+  auto next = batch.cbegin();
+  while (next != batch.cend()) {
+    insert_batch_helper(tree, tree.root, next, batch.cend(),
+                        (const Key *)nullptr);
+
+    if (tree.root->num_keys > Node::max_keys) {
+      grow_root(tree);
+    }
+  }
+}
+
+// Moves the last key (and, for internal nodes, the last child) of the
+// left sibling of parent->child(slot) through the parent into the
+// front of the child. A B+ tree leaf takes the key straight from its
+// sibling, and the separator becomes a copy of it.
+template <typename Tree, typename Node>
+void borrow_from_left(Tree &tree, Node *parent, int slot) {
+  Node *node = parent->child(slot);
+  Node *left = parent->child(slot - 1);
+
+  if (Node::is_bplus && node->is_leaf) {
+    insert_entry_at(node, 0, left, left->num_keys - 1);
+    remove_key_at(left, left->num_keys - 1);
+    set_separator(parent, slot - 1, node->keys[0]);
+  } else {
+    insert_entry_at(node, 0, parent, slot - 1);
+    if (!node->is_leaf) {
+      Node *moved = left->child(left->num_keys);
+      left->child(left->num_keys) = nullptr;
+      insert_child_at(node, moved, 0);
+      update_summary(node, 0);
+    }
+
+    set_entry(parent, slot - 1, left, left->num_keys - 1);
+    remove_key_at(left, left->num_keys - 1);
+  }
+
+  update_summary(parent, slot - 1);
+  update_summary(parent, slot);
+  debug_event(tree, btree_event::borrow, node);
+}
+
+// Moves the first key (and, for internal nodes, the first child) of
+// the right sibling of parent->child(slot) through the parent onto the
+// end of the child. As in borrow_from_left, a B+ tree leaf takes the
+// key straight from its sibling, whose new first key becomes the
+// separator.
+template <typename Tree, typename Node>
+void borrow_from_right(Tree &tree, Node *parent, int slot) {
+  Node *node = parent->child(slot);
+  Node *right = parent->child(slot + 1);
+
+  if (Node::is_bplus && node->is_leaf) {
+    insert_entry_at(node, node->num_keys, right, 0);
+    remove_key_at(right, 0);
+    set_separator(parent, slot, right->keys[0]);
+  } else {
+    insert_entry_at(node, node->num_keys, parent, slot);
+    if (!node->is_leaf) {
+      move_child(right, 0, node, node->num_keys);
+      remove_child_at(right, 0);
+    }
+
+    set_entry(parent, slot, right, 0);
+    remove_key_at(right, 0);
+  }
+
+  update_summary(parent, slot);
+  update_summary(parent, slot + 1);
+  debug_event(tree, btree_event::borrow, node);
+}
+
+// Merges parent->child(slot + 1) and the separator between them into
+// parent->child(slot), and frees the emptied right node. Merging two
+// B+ tree leaves drops the separator, which is only a copy, and takes
+// the right leaf out of the chain.
+template <typename Tree, typename Node>
+void merge_children(Tree &tree, Node *parent, int slot) {
+  Node *left = parent->child(slot);
+  Node *right = parent->child(slot + 1);
+
+  // Leaves of a B+ tree don't take a copy of the separator.
+  bool separator = !(Node::is_bplus && left->is_leaf);
+  int base = left->num_keys + separator;
+  if (separator) {
+    left->keys[left->num_keys] = parent->keys[slot];
+    move_value(parent, slot, left, left->num_keys);
+  }
+  for (int i = 0; i < right->num_keys; i++) {
+    left->keys[base + i] = right->keys[i];
+    move_value(right, i, left, base + i);
+  }
+  if (!left->is_leaf) {
+    for (int i = 0; i <= right->num_keys; i++) {
+      move_child(right, i, left, base + i);
+    }
+  } else if constexpr (Node::is_bplus) {
+    unlink_leaf(right);
+  }
+  left->num_keys = base + right->num_keys;
+  reindex(left);
+
+  remove_key_at(parent, slot);
+  remove_child_at(parent, slot + 1);
+  tree.free_node(right);
+  update_summary(parent, slot);
+  debug_event(tree, btree_event::merge, left);
+}
+
+// Tops up parent->child(slot), which has just dropped below min_keys,
+// from a sibling: borrowing a key if either has one to spare, merging
+// with one otherwise. A merge takes a key from the parent.
+template <typename Tree, typename Node>
+void fix_underflow(Tree &tree, Node *parent, int slot) {
+  if (slot > 0 && parent->child(slot - 1)->num_keys > Node::min_keys) {
+    borrow_from_left(tree, parent, slot);
+  } else if (slot < parent->num_keys &&
+             parent->child(slot + 1)->num_keys > Node::min_keys) {
+    borrow_from_right(tree, parent, slot);
+  } else if (slot > 0) {
+    merge_children(tree, parent, slot - 1);
+  } else {
+    merge_children(tree, parent, slot);
+  }
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool remove(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+            const typename nondeduced<Key>::type &key) {
+  using Node = btree<Key, Order, Search, Value, BPlus, Summary>;
+
+  if (tree.root == nullptr) {
+    return false;
+  }
+  tree.tail.path.depth = 0;
+
+  // Walk down to the key, remembering the way. In a B+ tree it is
+  // always in a leaf, right of any separator equal to it.
+  btree_path<Node> path;
+  Node *node = tree.root;
+  int pos_idx;
+  while (true) {
+    pos_idx = find_idx(node, key);
+    if (pos_idx < node->num_keys && node->keys[pos_idx] == key) {
+      if (node->is_leaf || !Node::is_bplus) {
+        break;
+      }
+      pos_idx++;
+    } else if (node->is_leaf) {
+      return false;
+    }
+    path.push(node, pos_idx);
+    node = node->child(pos_idx);
+  }
+
+  // A key in an internal node is replaced by its in-order predecessor,
+  // the last key of the rightmost leaf of its left subtree, so that
+  // the key actually taken out is always in a leaf. (This never
+  // happens in a B+ tree.)
+  if (!node->is_leaf) {
+    Node *holder = node;
+    int holder_idx = pos_idx;
+    path.push(node, pos_idx);
+    node = node->child(pos_idx);
+    while (!node->is_leaf) {
+      path.push(node, node->num_keys);
+      node = node->child(node->num_keys);
+    }
+    pos_idx = node->num_keys - 1;
+    set_entry(holder, holder_idx, node, pos_idx);
+  }
+  remove_key_at(node, pos_idx);
+  tree.key_count--;
+
+  // Walk back up, fixing each node that fell below min_keys. Only a
+  // merge takes a key from the parent, so this stops at the first
+  // level that didn't merge, unless there are summaries to update.
+  while (path.depth > 0) {
+    path.depth--;
+    Node *parent = path.nodes[path.depth];
+    int slot = path.slots[path.depth];
+    if (node->num_keys < Node::min_keys) {
+      fix_underflow(tree, parent, slot);
+    } else if (Node::is_summarized) {
+      update_summary(parent, slot);
+    } else {
+      break;
+    }
+    node = parent;
+  }
+
+  if (tree.root->num_keys == 0 && !tree.root->is_leaf) {
+    Node *old_root = tree.root;
+    tree.root = tree.root->child(0);
+    tree.free_node(old_root);
+    debug_event(tree, btree_event::root_collapse, tree.root);
+  }
+  return true;
+}
+
+// Returns how many nodes to split 'total' units between when each
+// node should get about 'target' of them. A unit is a child, or for
+// leaves a key (plus, outside a B+ tree, the separator that follows
+// it). The count is clamped so that spreading the units evenly leaves
+// every node with between low and high of them.
+inline long bulk_node_count(long total, long target, long low, long high) {
+  long count = (total + target - 1) / target;
+  long fewest = (total + high - 1) / high;
+  long most = total / low;
+
+  count = max(count, fewest);
+  count = min(count, most);
+  assert(count >= fewest);
+  return count;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary, typename Iter>
+void bulk_load(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+               Iter first, Iter last, double fill_factor) {
+  using Node = btree<Key, Order, Search, Value, BPlus, Summary>;
+
+  assert(adjacent_find(first, last, [](const Key &a, const Key &b) {
+           return !(a < b);
+         }) == last);
+
+  tree.clear();
+  long n = distance(first, last);
+  if (n == 0) {
+    return;
+  }
+  tree.key_count = n;
+
+  long target = lround(fill_factor * Node::max_keys) + 1;
+  target = max(target, (long)Node::min_keys + 1);
+  target = min(target, (long)Node::order);
+
+  // Leaves. In a B-tree each one is followed by a separator key for
+  // the level above, except the last, so a leaf's share of the units
+  // is one more than its keys. In a B+ tree the separator before each
+  // leaf but the first is a copy of its first key, and the leaves are
+  // chained together.
+  const long extra = Node::is_bplus ? 0 : 1;
+  long total = n + extra;
+  long count = total <= Node::max_keys + extra
+                   ? 1
+                   : bulk_node_count(total, target - 1 + extra,
+                                     Node::min_keys + extra,
+                                     Node::max_keys + extra);
+  vector<Node *> level;
+  vector<Key> separators;
+  level.reserve(count);
+  separators.reserve(count - 1);
+
+  for (long i = 0; i < count; i++) {
+    int keys = (int)(total / count + (i < total % count) - extra);
+    Node *leaf = init(tree, true);
+    if constexpr (Node::is_bplus) {
+      if (i > 0) {
+        separators.push_back(*first);
+        link_leaf_after(level.back(), leaf);
+      }
+    }
+    for (int k = 0; k < keys; k++, ++first) {
+      leaf->keys[k] = *first;
+    }
+    leaf->num_keys = keys;
+    reindex(leaf);
+    level.push_back(leaf);
+
+    if (!Node::is_bplus && i + 1 < count) {
+      separators.push_back(*first);
+      ++first;
+    }
+  }
+
+  // Internal levels, until one node is left to be the root. Node j of
+  // the level below sits between separators j-1 and j.
+  while (level.size() > 1) {
+    total = level.size();
+    count = total <= Order
+                ? 1
+                : bulk_node_count(total, target, Node::min_keys + 1, Order);
+    vector<Node *> parents;
+    vector<Key> parent_separators;
+    parents.reserve(count);
+    parent_separators.reserve(count - 1);
+
+    long next = 0;
+    for (long i = 0; i < count; i++) {
+      int children = (int)(total / count + (i < total % count));
+      Node *parent = init(tree, false);
+      for (int c = 0; c < children; c++, next++) {
+        parent->child(c) = level[next];
+        update_summary(parent, c);
+        if (c + 1 < children) {
+          parent->keys[c] = separators[next];
+        }
+      }
+      parent->num_keys = children - 1;
+      reindex(parent);
+      parents.push_back(parent);
+
+      if (i + 1 < count) {
+        parent_separators.push_back(separators[next - 1]);
+      }
+    }
+
+    level.swap(parents);
+    separators.swap(parent_separators);
+  }
+
+  tree.root = level[0];
+}
+
+template <typename Node>
+Node *find(Node *node, const typename Node::key_type &key) {
+  int pos_idx = find_idx(node, key);
+  if (pos_idx < node->num_keys && node->keys[pos_idx] == key) {
+    if (node->is_leaf || !Node::is_bplus) {
+      return node;
+    }
+    pos_idx++;
+  } else if (node->is_leaf) {
+    return node;
+  }
+
+  Node *child_node = find(node->child(pos_idx), key);
+  return child_node;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+map_value_t<Value, Summary> *
+find_value(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+           const typename nondeduced<Key>::type &key) {
+  static_assert(!is_void<Value>::value, "find_value needs a map");
+  using Node = btree<Key, Order, Search, Value, BPlus, Summary>;
+  Node *node = tree.root;
+  while (node != nullptr) {
+    int pos_idx = find_idx(node, key);
+    if (pos_idx < node->num_keys && node->keys[pos_idx] == key) {
+      if (node->is_leaf || !Node::is_bplus) {
+        return &node->values[pos_idx];
+      }
+      pos_idx++;
+    }
+    node = node->is_leaf ? nullptr : node->child(pos_idx);
+  }
+  return nullptr;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+btree<Key, Order, Search, Value, BPlus, Summary> *
+find(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+     const typename nondeduced<Key>::type &key) {
+  if (tree.root == nullptr) {
+    return nullptr;
+  }
+  return find(tree.root, key);
+}
+
+// Starts loading the parts of a node a search reads first: the header
+// and the middle of the keys, where the search makes its first probe.
+template <typename Node> void prefetch_node(const Node *node) {
+  __builtin_prefetch(node);
+  __builtin_prefetch(&node->keys[Node::max_keys / 2]);
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+btree<Key, Order, Search, Value, BPlus, Summary> *
+find_near(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+          typename btree_ptr<Key, Order, Search, Value, BPlus,
+                             Summary>::finger &hint,
+          const typename nondeduced<Key>::type &key) {
+  using Node = btree<Key, Order, Search, Value, BPlus, Summary>;
+  if (hint.covers(tree.root, key)) {
+    return hint.leaf();
+  }
+  if (tree.root == nullptr) {
+    return nullptr;
+  }
+
+  // Walk all the way down so that hint ends at a leaf, even if a
+  // B-tree has the key higher up.
+  Node *found = nullptr;
+  Node *node = tree.root;
+  hint.path.depth = 0;
+  while (true) {
+    int pos_idx = find_idx(node, key);
+    if (pos_idx < node->num_keys && node->keys[pos_idx] == key) {
+      if (found == nullptr && (node->is_leaf || !Node::is_bplus)) {
+        found = node;
+      }
+      pos_idx += !node->is_leaf;
+    }
+    hint.path.push(node, pos_idx);
+    if (node->is_leaf) {
+      return found != nullptr ? found : node;
+    }
+    node = node->child(pos_idx);
+  }
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+void contains_batch(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+                    const Key *keys, size_t n, uint64_t *found) {
+  using Node = btree<Key, Order, Search, Value, BPlus, Summary>;
+  for (size_t w = 0; w < (n + 63) / 64; w++) {
+    found[w] = 0;
+  }
+  if (tree.root == nullptr) {
+    return;
+  }
+
+  // nodes[i] is where lookup first + i goes next, or nullptr once it is
+  // done.
+  Node *nodes[batch_group_size];
+  for (size_t first = 0; first < n; first += batch_group_size) {
+    int group = n - first < (size_t)batch_group_size ? (int)(n - first)
+                                                     : batch_group_size;
+    for (int i = 0; i < group; i++) {
+      nodes[i] = tree.root;
+    }
+
+    int active = group;
+    while (active > 0) {
+      for (int i = 0; i < group; i++) {
+        Node *node = nodes[i];
+        if (node == nullptr) {
+          continue;
+        }
+        const Key &key = keys[first + i];
+        int pos_idx = find_idx(node, key);
+        bool hit = pos_idx < node->num_keys && node->keys[pos_idx] == key;
+        if (hit && (node->is_leaf || !Node::is_bplus)) {
+          found[(first + i) / 64] |= uint64_t(1) << ((first + i) % 64);
+          node = nullptr;
+        } else if (node->is_leaf) {
+          node = nullptr;
+        } else {
+          node = node->child(pos_idx + hit);
+          prefetch_node(node);
+        }
+        nodes[i] = node;
+        active -= node == nullptr;
+      }
+    }
+  }
+}
+
+template <typename Node>
+void btree_iterator<Node>::first_below(Node *node) {
+  if constexpr (Node::is_bplus) {
+    while (!node->is_leaf) {
+      node = node->child(0);
+    }
+    path.depth = 0;
+  } else {
+    while (!node->is_leaf) {
+      path.push(node, 0);
+      node = node->child(0);
+    }
+  }
+  path.push(node, 0);
+  settle();
+}
+
+template <typename Node>
+void btree_iterator<Node>::last_below(Node *node) {
+  if constexpr (Node::is_bplus) {
+    while (!node->is_leaf) {
+      node = node->child(node->num_keys);
+    }
+    path.depth = 0;
+  } else {
+    while (!node->is_leaf) {
+      path.push(node, node->num_keys);
+      node = node->child(node->num_keys);
+    }
+  }
+  path.push(node, node->num_keys - 1);
+}
+
+template <typename Node>
+void btree_iterator<Node>::settle() {
+  if (slot() < node()->num_keys) {
+    return;
+  }
+
+  if constexpr (Node::is_bplus) {
+    Node *next = node()->next_leaf();
+    path.depth = 0;
+    if (next != nullptr) {
+      path.push(next, 0);
+    }
+  } else {
+    // Climb out of every subtree the path is at the end of. The key
+    // after a subtree is the separator to its right, which has the
+    // same index as the child.
+    do {
+      path.depth--;
+    } while (path.depth > 0 && slot() == node()->num_keys);
+  }
+}
+
+template <typename Node>
+btree_iterator<Node> &btree_iterator<Node>::operator++() {
+  Node *node = this->node();
+  int idx = slot();
+  path.slots[path.depth - 1] = idx + 1;
+  if (!node->is_leaf) {
+    // The next key is the first one in the subtree after this key.
+    first_below(node->child(idx + 1));
+  } else {
+    settle();
+  }
+  return *this;
+}
+
+template <typename Node>
+btree_iterator<Node> &btree_iterator<Node>::operator--() {
+  if (path.depth == 0) {
+    last_below(root);
+    return *this;
+  }
+
+  Node *node = this->node();
+  int idx = slot();
+  if (!node->is_leaf) {
+    // The previous key is the last one in the subtree before this
+    // key, which is child idx.
+    last_below(node->child(idx));
+  } else if (idx > 0) {
+    path.slots[path.depth - 1]--;
+  } else if constexpr (Node::is_bplus) {
+    Node *prev = node->prev_leaf();
+    assert(prev != nullptr);
+    path.depth = 0;
+    path.push(prev, prev->num_keys - 1);
+  } else {
+    // Climb out of every subtree the path is at the start of; the key
+    // before a subtree is the separator to its left.
+    do {
+      path.depth--;
+    } while (path.depth > 0 && slot() == 0);
+    assert(path.depth > 0);
+    path.slots[path.depth - 1]--;
+  }
+  return *this;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator
+begin(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree) {
+  typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator it(
+      tree.root);
+  if (tree.root != nullptr) {
+    it.first_below(tree.root);
+  }
+  return it;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator
+end(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree) {
+  using tree_type = btree_ptr<Key, Order, Search, Value, BPlus, Summary>;
+  return typename tree_type::iterator(tree.root);
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::reverse_iterator
+rbegin(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree) {
+  using tree_type = btree_ptr<Key, Order, Search, Value, BPlus, Summary>;
+  return typename tree_type::reverse_iterator(end(tree));
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::reverse_iterator
+rend(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree) {
+  using tree_type = btree_ptr<Key, Order, Search, Value, BPlus, Summary>;
+  return typename tree_type::reverse_iterator(begin(tree));
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator
+lower_bound(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+            const typename nondeduced<Key>::type &key) {
+  using Node = btree<Key, Order, Search, Value, BPlus, Summary>;
+
+  btree_iterator<Node> it(tree.root);
+  Node *node = tree.root;
+  while (node != nullptr) {
+    int pos_idx = find_idx(node, key);
+    bool found = pos_idx < node->num_keys && node->keys[pos_idx] == key;
+    if (node->is_leaf || (found && !BPlus)) {
+      // If the key would go at the end of a leaf, the lower bound is
+      // the next key after that leaf.
+      it.path.push(node, pos_idx);
+      it.settle();
+      break;
+    }
+
+    if (found) {
+      pos_idx++;
+    }
+    if (!BPlus) {
+      it.path.push(node, pos_idx);
+    }
+    node = node->child(pos_idx);
+  }
+  return it;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator
+upper_bound(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+            const typename nondeduced<Key>::type &key) {
+  return equal_range(tree, key).second;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+pair<typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator,
+     typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator>
+equal_range(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+            const typename nondeduced<Key>::type &key) {
+  auto lower = lower_bound(tree, key);
+  auto upper = lower;
+  if (lower != end(tree) && *lower == key) {
+    ++upper;
+  }
+  return make_pair(lower, upper);
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+size_t rank_of(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+               const typename nondeduced<Key>::type &key) {
+  using Node = btree<Key, Order, Search, Value, BPlus, Summary>;
+  static_assert(Node::is_summarized, "rank_of needs subtree counts");
+
+  size_t rank = 0;
+  Node *node = tree.root;
+  while (node != nullptr) {
+    int pos_idx = find_idx(node, key);
+    if (node->is_leaf) {
+      return rank + pos_idx;
+    }
+
+    bool found = pos_idx < node->num_keys && node->keys[pos_idx] == key;
+    if (found && BPlus) {
+      pos_idx++;
+    }
+    // Everything under the children before pos_idx is less than key,
+    // and so are the separators between them, outside a B+ tree.
+    for (int i = 0; i < pos_idx; i++) {
+      rank += Summary::count(node->summary(i));
+    }
+    if (!BPlus) {
+      rank += pos_idx;
+    }
+    if (found && !BPlus) {
+      return rank + Summary::count(node->summary(pos_idx));
+    }
+    node = node->child(pos_idx);
+  }
+  return rank;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename btree_ptr<Key, Order, Search, Value, BPlus, Summary>::iterator
+select(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree, size_t k) {
+  using Node = btree<Key, Order, Search, Value, BPlus, Summary>;
+  static_assert(Node::is_summarized, "select needs subtree counts");
+
+  btree_iterator<Node> it(tree.root);
+  if (k >= tree.size()) {
+    return it;
+  }
+
+  // Skip whole children (and, outside a B+ tree, the separators after
+  // them) until the k-th key is under the next one, or is the next
+  // separator.
+  Node *node = tree.root;
+  while (!node->is_leaf) {
+    int i = 0;
+    while (true) {
+      size_t below = Summary::count(node->summary(i));
+      if (k < below) {
+        break;
+      }
+      k -= below;
+      if (!BPlus) {
+        if (k == 0) {
+          it.path.push(node, i);
+          return it;
+        }
+        k--;
+      }
+      i++;
+    }
+    if (!BPlus) {
+      it.path.push(node, i);
+    }
+    node = node->child(i);
+  }
+  it.path.push(node, (int)k);
+  return it;
+}
+
+// Returns the summary of the keys in [*lo, *hi) under node. A null
+// bound doesn't limit the range on that side. The children strictly
+// inside the range are covered by their stored summaries, so only the
+// children holding lo and hi are walked into.
+template <typename Node>
+typename Node::summary_type::type
+aggregate_range(Node *node, const typename Node::key_type *lo,
+                const typename Node::key_type *hi) {
+  using Summary = typename Node::summary_type;
+
+  // The range runs from the key (or child) at 'from' to the one at
+  // 'to', which is past the end for a leaf and the last child for an
+  // internal node. In a B+ tree, keys equal to a separator are in the
+  // child after it.
+  int from = 0;
+  int to = node->num_keys;
+  if (lo != nullptr) {
+    from = find_idx(node, *lo);
+    if (Node::is_bplus && !node->is_leaf && from < node->num_keys &&
+        node->keys[from] == *lo) {
+      from++;
+    }
+  }
+  if (hi != nullptr) {
+    to = find_idx(node, *hi);
+  }
+
+  typename Summary::type total = Summary::empty();
+  if (node->is_leaf) {
+    for (int i = from; i < to; i++) {
+      total = Summary::combine(total, Summary::entry(node, i));
+    }
+    return total;
+  }
+
+  for (int i = from; i <= to; i++) {
+    const typename Node::key_type *child_lo = i == from ? lo : nullptr;
+    const typename Node::key_type *child_hi = i == to ? hi : nullptr;
+    if (child_lo != nullptr || child_hi != nullptr) {
+      total = Summary::combine(
+          total, aggregate_range(node->child(i), child_lo, child_hi));
+    } else {
+      total = Summary::combine(total, node->summary(i));
+    }
+    if (!Node::is_bplus && i < to) {
+      total = Summary::combine(total, Summary::entry(node, i));
+    }
+  }
+  return total;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+typename Summary::type
+aggregate(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+          const typename nondeduced<Key>::type &lo,
+          const typename nondeduced<Key>::type &hi) {
+  using Node = btree<Key, Order, Search, Value, BPlus, Summary>;
+  static_assert(Node::is_summarized, "aggregate needs a summary policy");
+
+  if (tree.root == nullptr || !(lo < hi)) {
+    return Summary::empty();
+  }
+  return aggregate_range(tree.root, &lo, &hi);
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary, typename Visitor>
+size_t scan(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+            const typename nondeduced<Key>::type &lo,
+            const typename nondeduced<Key>::type &hi, Visitor visitor) {
+  using Node = btree<Key, Order, Search, Value, BPlus, Summary>;
+
+  size_t count = 0;
+  auto it = lower_bound(tree, lo);
+  while (it != end(tree)) {
+    // The run is the rest of a leaf, or one separator. Only the last
+    // run reaches hi, and only that one is searched for it.
+    Node *node = it.node();
+    int from = it.slot();
+    int to = node->is_leaf ? node->num_keys : from + 1;
+    bool last = !(node->keys[to - 1] < hi);
+    if (last) {
+      to = find_idx(node, hi);
+    }
+
+    if (to > from) {
+      count += to - from;
+      if (!visitor(&node->keys[from], to - from)) {
+        break;
+      }
+    }
+    if (last) {
+      break;
+    }
+
+    it.path.slots[it.path.depth - 1] = to - 1;
+    ++it;
+  }
+  return count;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+size_t scan_into(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+                 const typename nondeduced<Key>::type &lo,
+                 const typename nondeduced<Key>::type &hi, Key *buffer,
+                 size_t max) {
+  size_t copied = 0;
+  if (max == 0) {
+    return 0;
+  }
+
+  scan(tree, lo, hi, [&](const Key *keys, int n) {
+    size_t take = min((size_t)n, max - copied);
+    copy(keys, keys + take, buffer + copied);
+    copied += take;
+    return copied < max;
+  });
+  return copied;
+}
+
+template <typename Node>
+int count_nodes(Node *node) {
+  if (node == nullptr) {
+    return 0;
+  }
+
+  int count = 1;
+  for (int i = 0; !node->is_leaf && i < node->num_keys + 1; i++) {
+    if (node->child(i) != nullptr) {
+      count += count_nodes(node->child(i));
+    }
+  }
+  return count;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+int count_nodes(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree) {
+  return count_nodes(tree.root);
+}
+
+template <typename Node>
+int count_keys(Node *node) {
+  if (node == nullptr) {
+    return 0;
+  }
+
+  // A B+ tree's separators are copies of keys in the leaves.
+  int count = node->is_leaf || !Node::is_bplus ? node->num_keys : 0;
+  for (int i = 0; !node->is_leaf && i < node->num_keys + 1; i++) {
+    if (node->child(i) != nullptr) {
+      count += count_keys(node->child(i));
+    }
+  }
+
+  return count;
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+int count_keys(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree) {
+  return count_keys(tree.root);
+}
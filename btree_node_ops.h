@@ -0,0 +1,166 @@
+// btree_node_ops.h
+//
+// Node editing for the B+ trees whose nodes keep their keys in a plain
+// keys array and reach their children through child(i): the concurrent,
+// B-link and persistent trees. A child is whatever Node::child_type is,
+// a raw pointer or a shared_ptr; children are moved rather than copied,
+// which for a raw pointer is the same thing.
+//
+// These only rearrange keys and children within and between nodes; the
+// trees decide when to call them, allocate and free the nodes, and do
+// their own latching or copying around them. A node type whose readers
+// may read it while a writer changes it (the optimistic concurrent
+// tree's) says so with racy_reads, and every key, child and count is
+// then written with a relaxed atomic store, for its readers to load the
+// same way.
+
+#ifndef btree_node_ops_h
+#define btree_node_ops_h
+
+#include <atomic>
+#include <type_traits>
+#include <utility>
+
+#include "btree_search.h"
+
+using namespace std;
+
+// Whether Node has racy_reads set
+template <typename Node, typename = void>
+struct has_racy_reads : false_type {};
+template <typename Node>
+struct has_racy_reads<Node, void_t<decltype(Node::racy_reads)>>
+    : bool_constant<Node::racy_reads> {};
+
+// Sets field, a key, child or count of a Node, to value
+template <typename Node, typename T>
+void node_store(T &field, type_identity_t<T> value) {
+  if constexpr (has_racy_reads<Node>::value) {
+    atomic_ref<T>(field).store(value, memory_order_relaxed);
+  } else {
+    field = std::move(value);
+  }
+}
+
+// child_slot returns which child of an internal node key is under. A
+// key equal to a separator is in the child to its right.
+template <typename Node>
+int child_slot(const Node *node, const typename Node::key_type &key) {
+  int idx = search_keys(node->keys.data(), node->num_keys, key);
+  return idx + (idx < node->num_keys && node->keys[idx] == key);
+}
+
+// Puts key (and, in an internal node, child after it) in at idx
+template <typename Node>
+void node_insert_at(Node *node, int idx, const typename Node::key_type &key,
+                    typename Node::child_type child = nullptr) {
+  for (int i = node->num_keys; i > idx; i--) {
+    node_store<Node>(node->keys[i], node->keys[i - 1]);
+  }
+  node_store<Node>(node->keys[idx], key);
+  if (!node->is_leaf) {
+    for (int i = node->num_keys + 1; i > idx + 1; i--) {
+      node_store<Node>(node->child(i), std::move(node->child(i - 1)));
+    }
+    node_store<Node>(node->child(idx + 1), std::move(child));
+  }
+  node_store<Node>(node->num_keys, node->num_keys + 1);
+}
+
+// Takes out the key at idx (and, in an internal node, the child after
+// it)
+template <typename Node> void node_remove_at(Node *node, int idx) {
+  for (int i = idx + 1; i < node->num_keys; i++) {
+    node_store<Node>(node->keys[i - 1], node->keys[i]);
+  }
+  if (!node->is_leaf) {
+    for (int i = idx + 2; i <= node->num_keys; i++) {
+      node_store<Node>(node->child(i - 1), std::move(node->child(i)));
+    }
+    node_store<Node>(node->child(node->num_keys), nullptr);
+  }
+  node_store<Node>(node->num_keys, node->num_keys - 1);
+}
+
+// Moves the upper half of node, which is one key over max_keys, into
+// right, a new empty node of the same kind, and returns the separator
+// that goes between them in the parent. As in a B+ tree, a leaf keeps a
+// copy of the separator in right, and an internal node hands it up.
+template <typename Node>
+typename Node::key_type node_split(Node *node, Node *right) {
+  int mid = node->num_keys / 2;
+  int first = node->is_leaf ? mid : mid + 1;
+  for (int i = first; i < node->num_keys; i++) {
+    node_store<Node>(right->keys[i - first], node->keys[i]);
+  }
+  if (!node->is_leaf) {
+    for (int i = first; i <= node->num_keys; i++) {
+      node_store<Node>(right->child(i - first), std::move(node->child(i)));
+    }
+  }
+  node_store<Node>(right->num_keys, node->num_keys - first);
+  node_store<Node>(node->num_keys, mid);
+  return node->keys[mid];
+}
+
+// Moves one key into parent->child(slot) from left, its left sibling,
+// through the parent if they are internal nodes
+template <typename Node>
+void node_borrow_left(Node *parent, int slot, Node *left, Node *node) {
+  int last = left->num_keys - 1;
+  if (node->is_leaf) {
+    node_insert_at(node, 0, left->keys[last]);
+    node_store<Node>(parent->keys[slot - 1], node->keys[0]);
+  } else {
+    node_insert_at(node, 0, parent->keys[slot - 1]);
+    // node_insert_at put an empty child after the key; the child that
+    // comes over from the left goes first instead.
+    node_store<Node>(node->child(1), std::move(node->child(0)));
+    node_store<Node>(node->child(0), std::move(left->child(last + 1)));
+    node_store<Node>(parent->keys[slot - 1], left->keys[last]);
+  }
+  node_store<Node>(left->num_keys, last);
+}
+
+// Moves one key into parent->child(slot) from right, its right sibling
+template <typename Node>
+void node_borrow_right(Node *parent, int slot, Node *node, Node *right) {
+  if (node->is_leaf) {
+    node_insert_at(node, node->num_keys, right->keys[0]);
+    node_remove_at(right, 0);
+    node_store<Node>(parent->keys[slot], right->keys[0]);
+  } else {
+    int n = node->num_keys;
+    node_store<Node>(node->keys[n], parent->keys[slot]);
+    node_store<Node>(node->child(n + 1), std::move(right->child(0)));
+    node_store<Node>(node->num_keys, n + 1);
+    node_store<Node>(parent->keys[slot], right->keys[0]);
+    for (int i = 1; i < right->num_keys; i++) {
+      node_store<Node>(right->keys[i - 1], right->keys[i]);
+    }
+    for (int i = 1; i <= right->num_keys; i++) {
+      node_store<Node>(right->child(i - 1), std::move(right->child(i)));
+    }
+    node_store<Node>(right->num_keys, right->num_keys - 1);
+  }
+}
+
+// Folds right into left, its left sibling, and drops parent's key at
+// slot and the child after it (right). The caller disposes of right.
+template <typename Node>
+void node_merge(Node *parent, int slot, Node *left, Node *right) {
+  int n = left->num_keys;
+  if (!left->is_leaf) {
+    node_store<Node>(left->keys[n++], parent->keys[slot]);
+    for (int i = 0; i <= right->num_keys; i++) {
+      node_store<Node>(left->child(n + i), std::move(right->child(i)));
+    }
+  }
+  for (int i = 0; i < right->num_keys; i++) {
+    node_store<Node>(left->keys[n + i], right->keys[i]);
+  }
+  node_store<Node>(left->num_keys, n + right->num_keys);
+  node_remove_at(parent, slot);
+}
+
+#endif
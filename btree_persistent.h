@@ -0,0 +1,318 @@
+// btree_persistent.h
+//
+// persistent_btree is a B+ tree set whose nodes never change once a
+// tree points to them. insert and remove copy the nodes on the path
+// from the root down to the leaf they change (and a sibling, when one
+// has to lend a key or take a merge), and point the tree at the new
+// root; every other node is shared with the old version. So copying a
+// persistent_btree takes an O(1) snapshot: the copy keeps seeing the
+// tree as it was, however much the original changes afterwards, and
+// the two share all the nodes they have in common.
+//
+// Nodes are held by shared_ptr, and go when the last version that
+// reaches them does. A snapshot can be read by other threads while the
+// tree it was taken from goes on changing; a single persistent_btree
+// value must not be changed and read at once.
+//
+// The nodes can't come from a btree_ptr's arenas, which belong to one
+// tree and free everything with it, and there is no leaf chain, which
+// would tie each leaf to its neighbours' versions.
+
+#ifndef btree_persistent_h
+#define btree_persistent_h
+
+#include <array>
+#include <cstddef>
+#include <memory>
+
+#include "btree.h"
+#include "btree_node_ops.h"
+
+using namespace std;
+
+template <typename Key, int Order> struct persistent_internal;
+
+template <typename Key, int Order>
+struct persistent_node : node_limits<Order> {
+  using key_type = Key;
+  using child_type = shared_ptr<const persistent_node>;
+  using internal_type = persistent_internal<Key, Order>;
+
+  bool is_leaf;
+  int num_keys = 0;
+
+  // Like btree's, keys has room for one key over the limit, which a
+  // split then takes away.
+  array<Key, Order> keys;
+
+  // child returns the i-th child of an internal node. Don't call it on
+  // a leaf.
+  const shared_ptr<const persistent_node> &child(int i) const {
+    return static_cast<const internal_type *>(this)->children[i];
+  }
+  shared_ptr<const persistent_node> &child(int i) {
+    return static_cast<internal_type *>(this)->children[i];
+  }
+
+  explicit persistent_node(bool is_leaf = true) : is_leaf(is_leaf) {}
+};
+
+// Leaves are plain persistent_nodes; internal nodes add the children.
+template <typename Key, int Order>
+struct persistent_internal : persistent_node<Key, Order> {
+  array<shared_ptr<const persistent_node<Key, Order>>, Order + 1> children;
+
+  persistent_internal() : persistent_node<Key, Order>(false) {}
+};
+
+template <typename Key = int, int Order = 64> struct persistent_btree {
+  using key_type = Key;
+  using node_type = persistent_node<Key, Order>;
+
+  // root is the root node, or null while the tree is empty.
+  shared_ptr<const node_type> root;
+
+  size_t key_count = 0;
+
+  // size is the number of keys in the tree.
+  size_t size() const { return key_count; }
+
+  // snapshot returns a copy of the tree as it is now, which later
+  // changes to this one don't touch.
+  persistent_btree snapshot() const { return *this; }
+};
+
+// Returns a private copy of node, to change before anything points to
+// it.
+template <typename Node> shared_ptr<Node> persistent_copy(const Node *node) {
+  if (node->is_leaf) {
+    return make_shared<Node>(*node);
+  }
+  using Internal = typename Node::internal_type;
+  return make_shared<Internal>(*static_cast<const Internal *>(node));
+}
+
+// Splits node, a private copy one key over max_keys, returning the new
+// right half and setting separator to the key that goes between them
+// in the parent.
+template <typename Node>
+shared_ptr<Node> persistent_split(Node *node,
+                                  typename Node::key_type &separator) {
+  shared_ptr<Node> right =
+      node->is_leaf ? make_shared<Node>()
+                    : shared_ptr<Node>(make_shared<typename Node::internal_type>());
+  separator = node_split(node, right.get());
+  return right;
+}
+
+// Returns a copy of node with key added under it, or null if key is
+// already there. If the copy went over max_keys it has been split:
+// split_right is then its right half and separator the key between
+// them. Otherwise split_right is left null.
+template <typename Node>
+shared_ptr<Node> persistent_insert(const Node *node,
+                                   const typename Node::key_type &key,
+                                   shared_ptr<Node> &split_right,
+                                   typename Node::key_type &separator) {
+  shared_ptr<Node> copy;
+  if (node->is_leaf) {
+    int idx = search_keys(node->keys.data(), node->num_keys, key);
+    if (idx < node->num_keys && node->keys[idx] == key) {
+      return nullptr;
+    }
+    copy = persistent_copy(node);
+    node_insert_at(copy.get(), idx, key);
+  } else {
+    int slot = child_slot(node, key);
+    shared_ptr<Node> child_right;
+    typename Node::key_type child_separator;
+    shared_ptr<Node> child = persistent_insert(node->child(slot).get(), key,
+                                               child_right, child_separator);
+    if (child == nullptr) {
+      return nullptr;
+    }
+    copy = persistent_copy(node);
+    copy->child(slot) = std::move(child);
+    if (child_right != nullptr) {
+      node_insert_at(copy.get(), slot, child_separator,
+                     shared_ptr<const Node>(std::move(child_right)));
+    }
+  }
+  if (copy->num_keys > Node::max_keys) {
+    split_right = persistent_split(copy.get(), separator);
+  }
+  return copy;
+}
+
+// Puts node, a copy of parent->child(slot) that has dropped below
+// min_keys, in its place, topping it up from a sibling or merging the
+// two. The sibling is copied, as it changes too, so the node_* helpers
+// only ever edit private copies.
+template <typename Node>
+void persistent_fix_underflow(Node *parent, int slot, shared_ptr<Node> node) {
+  if (slot > 0) {
+    shared_ptr<Node> left = persistent_copy(parent->child(slot - 1).get());
+    if (left->num_keys > Node::min_keys) {
+      node_borrow_left(parent, slot, left.get(), node.get());
+      parent->child(slot) = std::move(node);
+    } else {
+      node_merge(parent, slot - 1, left.get(), node.get());
+    }
+    parent->child(slot - 1) = std::move(left);
+  } else {
+    shared_ptr<Node> right = persistent_copy(parent->child(1).get());
+    if (right->num_keys > Node::min_keys) {
+      node_borrow_right(parent, slot, node.get(), right.get());
+      parent->child(1) = std::move(right);
+    } else {
+      node_merge(parent, slot, node.get(), right.get());
+    }
+    parent->child(0) = std::move(node);
+  }
+}
+
+// Returns a copy of node with key taken out from under it, or null if
+// key isn't there. The copy may be left below min_keys, for its parent
+// to fix.
+template <typename Node>
+shared_ptr<Node> persistent_remove(const Node *node,
+                                   const typename Node::key_type &key) {
+  if (node->is_leaf) {
+    int idx = search_keys(node->keys.data(), node->num_keys, key);
+    if (idx == node->num_keys || !(node->keys[idx] == key)) {
+      return nullptr;
+    }
+    shared_ptr<Node> copy = persistent_copy(node);
+    node_remove_at(copy.get(), idx);
+    return copy;
+  }
+
+  int slot = child_slot(node, key);
+  shared_ptr<Node> child = persistent_remove(node->child(slot).get(), key);
+  if (child == nullptr) {
+    return nullptr;
+  }
+  shared_ptr<Node> copy = persistent_copy(node);
+  if (child->num_keys < Node::min_keys) {
+    persistent_fix_underflow(copy.get(), slot, std::move(child));
+  } else {
+    copy->child(slot) = std::move(child);
+  }
+  return copy;
+}
+
+// Hands visitor the runs of keys in [lo, hi) under node, as scan does,
+// adding how many to count. Returns false once the scan is over.
+template <typename Node, typename Visitor>
+bool persistent_scan(const Node *node, const typename Node::key_type &lo,
+                     const typename Node::key_type &hi, Visitor &visitor,
+                     size_t &count) {
+  if (node->is_leaf) {
+    int from = search_keys(node->keys.data(), node->num_keys, lo);
+    int to = search_keys(node->keys.data(), node->num_keys, hi);
+    if (to > from) {
+      count += to - from;
+      if (!visitor(&node->keys[from], to - from)) {
+        return false;
+      }
+    }
+    return to == node->num_keys;
+  }
+  for (int i = child_slot(node, lo); i <= node->num_keys; i++) {
+    if (i > 0 && !(node->keys[i - 1] < hi)) {
+      return false;
+    }
+    if (!persistent_scan(node->child(i).get(), lo, hi, visitor, count)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// contains returns whether key is in the tree.
+template <typename Key, int Order>
+bool contains(const persistent_btree<Key, Order> &tree,
+              const typename nondeduced<Key>::type &key) {
+  const persistent_node<Key, Order> *node = tree.root.get();
+  if (node == nullptr) {
+    return false;
+  }
+  while (!node->is_leaf) {
+    node = node->child(child_slot(node, key)).get();
+  }
+  int idx = search_keys(node->keys.data(), node->num_keys, key);
+  return idx < node->num_keys && node->keys[idx] == key;
+}
+
+// insert adds key to the tree, returning whether it wasn't there yet.
+// Snapshots of the tree don't see it.
+template <typename Key, int Order>
+bool insert(persistent_btree<Key, Order> &tree,
+            const typename nondeduced<Key>::type &key) {
+  using Node = persistent_node<Key, Order>;
+  if (tree.root == nullptr) {
+    shared_ptr<Node> leaf = make_shared<Node>();
+    node_insert_at(leaf.get(), 0, key);
+    tree.root = std::move(leaf);
+    tree.key_count = 1;
+    return true;
+  }
+
+  shared_ptr<Node> right;
+  Key separator;
+  shared_ptr<Node> root =
+      persistent_insert(tree.root.get(), key, right, separator);
+  if (root == nullptr) {
+    return false;
+  }
+  if (right != nullptr) {
+    shared_ptr<Node> grown = make_shared<typename Node::internal_type>();
+    grown->keys[0] = separator;
+    grown->child(0) = std::move(root);
+    grown->child(1) = std::move(right);
+    grown->num_keys = 1;
+    root = std::move(grown);
+  }
+  tree.root = std::move(root);
+  tree.key_count++;
+  return true;
+}
+
+// remove deletes key from the tree, returning whether it was there.
+// Snapshots of the tree still have it.
+template <typename Key, int Order>
+bool remove(persistent_btree<Key, Order> &tree,
+            const typename nondeduced<Key>::type &key) {
+  using Node = persistent_node<Key, Order>;
+  if (tree.root == nullptr) {
+    return false;
+  }
+  shared_ptr<Node> root = persistent_remove(tree.root.get(), key);
+  if (root == nullptr) {
+    return false;
+  }
+  if (root->num_keys == 0) {
+    tree.root = root->is_leaf ? nullptr : root->child(0);
+  } else {
+    tree.root = std::move(root);
+  }
+  tree.key_count--;
+  return true;
+}
+
+// scan hands visitor(keys, n) the keys in [lo, hi), in ascending
+// order, a run from one leaf at a time, as btree_ptr's scan does, and
+// stops early if visitor returns false. It returns how many keys it
+// handed over.
+template <typename Key, int Order, typename Visitor>
+size_t scan(const persistent_btree<Key, Order> &tree,
+            const typename nondeduced<Key>::type &lo,
+            const typename nondeduced<Key>::type &hi, Visitor visitor) {
+  size_t count = 0;
+  if (tree.root != nullptr && lo < hi) {
+    persistent_scan(tree.root.get(), lo, hi, visitor, count);
+  }
+  return count;
+}
+
+#endif
@@ -0,0 +1,238 @@
+// btree_search.h
+//
+// In-node key search. search_keys(keys, n, target) returns how many
+// of the n sorted keys are less than target, which is both the index
+// of target if it is present and the slot it would be inserted at
+// otherwise.
+//
+// The generic version is a branchless binary search. int32 and int64
+// keys get a vectorized version: a branchless binary search narrows
+// the range down to a small window, then the window is compared
+// against the target a whole vector at a time, and the comparison
+// masks are popcounted. Which instructions are used is picked at
+// compile time from the target flags (-mavx2, -msse4.2, or plain SSE2
+// on x86-64); define BTREE_SCALAR_SEARCH to force the scalar version.
+//
+// A tree picks how its nodes are searched with a search policy, the
+// third template parameter of btree and btree_ptr:
+//
+//   sorted_search     search_keys on the sorted keys array (default).
+//   sampled_search    a small array of every 16th key picks the block
+//                     of keys to search.
+//   eytzinger_search  each node also keeps a copy of its keys in
+//                     Eytzinger (BFS) order, searched branchlessly.
+//
+// btree_bench compares them. For orders of 64 and up sampled_search
+// makes whole-tree lookups faster; eytzinger_search is the fastest on
+// a node that is already in cache, but more than doubles the node size,
+// which costs more than it saves once nodes come from memory.
+//
+// A policy has a per-node index type, rebuild(), which the tree calls
+// whenever a node's keys change, and search(), which must return the
+// same answer search_keys would. The keys array itself stays sorted
+// either way.
+
+#ifndef btree_search_h
+#define btree_search_h
+
+#include <array>
+#include <cstdint>
+
+#if !defined(BTREE_SCALAR_SEARCH) && defined(__SSE2__)
+#define BTREE_SIMD_SEARCH 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+// Ranges at or below this many keys are counted with a linear scan
+// instead of being narrowed further.
+constexpr int search_scan_window = 32;
+
+// search_keys_scalar is a branchless lower bound: each step halves the
+// range with a conditional move instead of a branch on the comparison.
+template <typename Key>
+int search_keys_scalar(const Key *keys, int n, const Key &target) {
+  if (n == 0) {
+    return 0;
+  }
+
+  const Key *base = keys;
+  while (n > 1) {
+    int half = n / 2;
+    base = (base[half - 1] < target) ? base + half : base;
+    n -= half;
+  }
+  return (int)(base - keys) + (*base < target);
+}
+
+template <typename Key>
+int search_keys(const Key *keys, int n, const Key &target) {
+  return search_keys_scalar(keys, n, target);
+}
+
+#ifdef BTREE_SIMD_SEARCH
+
+// count_less returns how many of keys[0..n) are less than target.
+inline int count_less(const int32_t *keys, int n, int32_t target) {
+  int count = 0;
+  int i = 0;
+#ifdef __AVX2__
+  const __m256i wide = _mm256_set1_epi32(target);
+  for (; i + 8 <= n; i += 8) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(keys + i));
+    __m256i less = _mm256_cmpgt_epi32(wide, block);
+    count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(less)));
+  }
+#endif
+  const __m128i narrow = _mm_set1_epi32(target);
+  for (; i + 4 <= n; i += 4) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(keys + i));
+    __m128i less = _mm_cmpgt_epi32(narrow, block);
+    count += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(less)));
+  }
+  for (; i < n; i++) {
+    count += keys[i] < target;
+  }
+  return count;
+}
+
+inline int count_less(const int64_t *keys, int n, int64_t target) {
+  int count = 0;
+  int i = 0;
+#ifdef __AVX2__
+  const __m256i wide = _mm256_set1_epi64x(target);
+  for (; i + 4 <= n; i += 4) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(keys + i));
+    __m256i less = _mm256_cmpgt_epi64(wide, block);
+    count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(less)));
+  }
+#elif defined(__SSE4_2__)
+  const __m128i narrow = _mm_set1_epi64x(target);
+  for (; i + 2 <= n; i += 2) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(keys + i));
+    __m128i less = _mm_cmpgt_epi64(narrow, block);
+    count += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(less)));
+  }
+#endif
+  for (; i < n; i++) {
+    count += keys[i] < target;
+  }
+  return count;
+}
+
+// search_keys_simd narrows [keys, keys+n) the same way
+// search_keys_scalar does until at most search_scan_window keys are
+// left, then counts the rest.
+template <typename Key>
+int search_keys_simd(const Key *keys, int n, Key target) {
+  const Key *base = keys;
+  while (n > search_scan_window) {
+    int half = n / 2;
+    base = (base[half - 1] < target) ? base + half : base;
+    n -= half;
+  }
+  return (int)(base - keys) + count_less(base, n, target);
+}
+
+inline int search_keys(const int32_t *keys, int n, int32_t target) {
+  return search_keys_simd(keys, n, target);
+}
+
+inline int search_keys(const int64_t *keys, int n, int64_t target) {
+  return search_keys_simd(keys, n, target);
+}
+
+#endif
+
+// sorted_search searches the sorted keys directly and keeps no index.
+struct sorted_search {
+  template <typename Key, int Order> struct node_index {};
+
+  template <typename Key, int Order>
+  static void rebuild(node_index<Key, Order> &, const Key *, int) {}
+
+  template <typename Key, int Order>
+  static int search(const node_index<Key, Order> &, const Key *keys, int n,
+                    const Key &target) {
+    return search_keys(keys, n, target);
+  }
+};
+
+// sampled_search keeps every Block-th key (the last key of each full
+// block) in a small array of samples. A search finds the block in the
+// samples, then searches just that block of the sorted keys, so it
+// touches a couple of cache lines however big the node is.
+template <int Block = 16> struct sampled_search {
+  template <typename Key, int Order> struct node_index {
+    array<Key, Order / Block + 1> samples;
+  };
+
+  template <typename Key, int Order>
+  static void rebuild(node_index<Key, Order> &index, const Key *keys, int n) {
+    for (int b = 0; (b + 1) * Block <= n; b++) {
+      index.samples[b] = keys[(b + 1) * Block - 1];
+    }
+  }
+
+  template <typename Key, int Order>
+  static int search(const node_index<Key, Order> &index, const Key *keys,
+                    int n, const Key &target) {
+    int block = search_keys(index.samples.data(), n / Block, target);
+    int start = block * Block;
+    int len = n - start < Block ? n - start : Block;
+    return start + search_keys(keys + start, len, target);
+  }
+};
+
+// eytzinger_search lays a node's keys out as an implicit binary search
+// tree: slot 1 is the root and slot k has children 2k and 2k+1. A
+// search walks down with k = 2k + (eyt[k] < target), which has no
+// branch on the comparison, and the first few levels are shared by
+// every search so they stay in cache. Once k runs off the bottom, its
+// trailing 1 bits are the right turns taken since the last left turn;
+// shifting them (and that left turn) off gives the slot of the lower
+// bound. pos maps a slot back to its index in the sorted keys.
+struct eytzinger_search {
+  template <typename Key, int Order> struct node_index {
+    static_assert(Order < 65536, "pos indexes must fit in 16 bits");
+
+    // eyt[1..n] are the keys in Eytzinger order; eyt[0] is unused.
+    array<Key, Order + 1> eyt;
+    array<uint16_t, Order + 1> pos;
+  };
+
+  template <typename Key, int Order>
+  static void rebuild(node_index<Key, Order> &index, const Key *keys, int n) {
+    fill(index, keys, n, 0, 1);
+  }
+
+  template <typename Key, int Order>
+  static int search(const node_index<Key, Order> &index, const Key *, int n,
+                    const Key &target) {
+    int k = 1;
+    while (k <= n) {
+      k = 2 * k + (index.eyt[k] < target);
+    }
+    k >>= __builtin_ffs(~k);
+    return k == 0 ? n : index.pos[k];
+  }
+
+private:
+  // fill does an in-order walk of the implicit tree below slot k,
+  // handing out sorted keys from keys[i] on. It returns the index of
+  // the next key to hand out.
+  template <typename Key, int Order>
+  static int fill(node_index<Key, Order> &index, const Key *keys, int n,
+                  int i, int k) {
+    if (k <= n) {
+      i = fill(index, keys, n, i, 2 * k);
+      index.eyt[k] = keys[i];
+      index.pos[k] = (uint16_t)i;
+      i = fill(index, keys, n, i + 1, 2 * k + 1);
+    }
+    return i;
+  }
+};
+
+#endif
@@ -0,0 +1,116 @@
+// btree_summary.h
+//
+// Subtree summaries. A tree can keep, next to each child pointer in an
+// internal node, a summary of every key in that child's subtree, so
+// that questions about a whole subtree are answered without walking
+// into it. The summary policy, the sixth template parameter of btree
+// and btree_ptr, picks what is kept:
+//
+//   no_summary      nothing (default); internal nodes carry no extra
+//                   array and updates cost nothing.
+//   subtree_counts  how many keys the subtree holds, which is what
+//                   rank and select need.
+//   monoid_summary  a count, and a user-supplied monoid (sum_of,
+//                   min_of, max_of, ...) over the subtree's entries,
+//                   for aggregate over a range of keys.
+//
+// A policy has the summary type, type; empty(), the summary of no
+// keys; entry(node, idx), the summary of the single key at idx; and
+// combine(a, b), which must be associative. A policy whose summary
+// includes a key count also has count(summary). The tree recomputes a
+// child's summary from the child's keys and its own child summaries
+// whenever the child changes, along the path of every insert and
+// remove, which costs O(Order) per level.
+
+#ifndef btree_summary_h
+#define btree_summary_h
+
+#include <cstddef>
+#include <limits>
+
+using namespace std;
+
+// no_summary keeps nothing.
+struct no_summary {};
+
+// subtree_counts summarizes a subtree by the number of keys in it.
+struct subtree_counts {
+  using type = size_t;
+
+  static size_t empty() { return 0; }
+
+  template <typename Node> static size_t entry(const Node *, int) {
+    return 1;
+  }
+
+  static size_t combine(size_t a, size_t b) { return a + b; }
+
+  static size_t count(size_t summary) { return summary; }
+};
+
+// monoid_summary<Monoid> summarizes a subtree by the number of keys
+// in it and by Monoid combined over its entries in key order. A Monoid
+// has a value type, type; identity(); an associative combine(a, b);
+// and of(key), or in a map of(key, value), the value one entry puts
+// in. sum_of, min_of and max_of below total up the keys of a set or
+// the values of a map.
+//
+// In a map the summaries depend on the values, so find_value and
+// iterators only give const access to them (see map_value_t in
+// btree.h); change values through insert_or_assign.
+template <typename Monoid> struct monoid_summary {
+  struct type {
+    size_t count;
+    typename Monoid::type value;
+
+    bool operator==(const type &other) const {
+      return count == other.count && value == other.value;
+    }
+  };
+
+  static type empty() { return {0, Monoid::identity()}; }
+
+  template <typename Node> static type entry(const Node *node, int idx) {
+    if constexpr (Node::is_map) {
+      return {1, Monoid::of(node->keys[idx], node->values[idx])};
+    } else {
+      return {1, Monoid::of(node->keys[idx])};
+    }
+  }
+
+  static type combine(const type &a, const type &b) {
+    return {a.count + b.count, Monoid::combine(a.value, b.value)};
+  }
+
+  static size_t count(const type &summary) { return summary.count; }
+};
+
+// entry_monoid holds what sum_of, min_of and max_of share: an entry
+// puts in its key in a set, or its value in a map.
+template <typename T> struct entry_monoid {
+  using type = T;
+
+  template <typename Key> static T of(const Key &key) { return key; }
+
+  template <typename Key, typename Value>
+  static T of(const Key &, const Value &value) {
+    return value;
+  }
+};
+
+template <typename T> struct sum_of : entry_monoid<T> {
+  static T identity() { return T(); }
+  static T combine(const T &a, const T &b) { return a + b; }
+};
+
+template <typename T> struct min_of : entry_monoid<T> {
+  static T identity() { return numeric_limits<T>::max(); }
+  static T combine(const T &a, const T &b) { return b < a ? b : a; }
+};
+
+template <typename T> struct max_of : entry_monoid<T> {
+  static T identity() { return numeric_limits<T>::lowest(); }
+  static T combine(const T &a, const T &b) { return a < b ? b : a; }
+};
+
+#endif
@@ -12,6 +12,11 @@
 #include "btree.h"
 #include "btree_unittest_help.h"
 #include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
 
 using namespace std;
 
@@ -21,7 +26,7 @@ using namespace std;
 TEST_CASE("B-Tree: Sanity Check", "[sanity]") {
   // run this one with the following command line:
   // ./btree_test "[sanity]"
-  shared_ptr<btree> small = build_small();
+  btree_ptr<> small = build_small();
   cout << "print_tree writes something like: \"graph btree{ ... }\" to stdout."
        << endl;
   cout << "use webgraphviz.com to turn that into diagrams of your tree." << endl
@@ -33,104 +38,111 @@ TEST_CASE("B-Tree: Sanity Check", "[sanity]") {
   REQUIRE(private_contains(small, 13));
   REQUIRE_FALSE(private_contains(small, 14));
 
-  shared_ptr<btree> broken = build_broken(); // invariant should fail
+  btree_ptr<> broken = build_broken(); // invariant should fail
   REQUIRE_FALSE(check_tree(broken));         // be sure we catch that
 }
 
 TEST_CASE("B-Tree: Report number of nodes", "[count nodes]") {
-  shared_ptr<btree> empty = build_empty();
+  btree_ptr<> empty = build_empty();
   REQUIRE(count_nodes(empty) == 1); // not zero, since there's a root node
 
-  shared_ptr<btree> small = build_small();
+  btree_ptr<> small = build_small();
   REQUIRE(count_nodes(small) == 4);
 
-  shared_ptr<btree> two_thin = build_two_tier();
+  btree_ptr<> two_thin = build_two_tier();
   REQUIRE(count_nodes(two_thin) == 5);
 
-  shared_ptr<btree> two_full = build_full_two_tier();
+  btree_ptr<> two_full = build_full_two_tier();
   REQUIRE(count_nodes(two_full) == 6);
 
-  shared_ptr<btree> thrice = build_thin_three_tier();
+  btree_ptr<> thrice = build_thin_three_tier();
   REQUIRE(count_nodes(thrice) == 9);
 }
 
 TEST_CASE("B-Tree: Report number of keys", "[count keys]") {
-  shared_ptr<btree> empty = build_empty();
+  btree_ptr<> empty = build_empty();
   REQUIRE(count_keys(empty) == 0);
 
-  shared_ptr<btree> small = build_small();
+  btree_ptr<> small = build_small();
   REQUIRE(count_keys(small) == 8);
 
-  shared_ptr<btree> two_thin = build_two_tier();
+  btree_ptr<> two_thin = build_two_tier();
   REQUIRE(count_keys(two_thin) == 14);
 
-  shared_ptr<btree> two_full = build_full_two_tier();
+  btree_ptr<> two_full = build_full_two_tier();
   REQUIRE(count_keys(two_full) == 19);
 
-  shared_ptr<btree> thrice = build_thin_three_tier();
+  btree_ptr<> thrice = build_thin_three_tier();
   REQUIRE(count_keys(thrice) == 17);
 }
 
 TEST_CASE("B-Tree: Find present key in leaf", "[find present leaf]") {
-  shared_ptr<btree> small = build_small();
-  shared_ptr<btree> node;
+  btree_ptr<> small = build_small();
+  btree<> *node;
 
   node = find(small, 17);
-  REQUIRE(node == small->children[1]);
+  REQUIRE(node == small->child(1));
 
   node = find(small, 2);
-  REQUIRE(node == small->children[0]);
+  REQUIRE(node == small->child(0));
 
   node = find(small, 28);
-  REQUIRE(node == small->children[2]);
+  REQUIRE(node == small->child(2));
 }
 
 TEST_CASE("B-Tree: Find present key in internal node", "[find present intnl]") {
-  shared_ptr<btree> thrice = build_thin_three_tier();
-  shared_ptr<btree> node;
+  btree_ptr<> thrice = build_thin_three_tier();
+  btree<> *node;
 
   node = find(thrice, 7);
-  REQUIRE(node == thrice->children[0]);
+  REQUIRE(node == thrice->child(0));
 
   node = find(thrice, 17);
-  REQUIRE(node == thrice->children[1]);
+  REQUIRE(node == thrice->child(1));
 }
 
 TEST_CASE("B-Tree: Find present key in root", "[find present root]") {
-  shared_ptr<btree> small = build_small();
-  shared_ptr<btree> node;
+  btree_ptr<> small = build_small();
+  btree<> *node;
 
   node = find(small, 10);
-  REQUIRE(node == small);
+  REQUIRE(node == small.root);
 
   node = find(small, 20);
-  REQUIRE(node == small);
+  REQUIRE(node == small.root);
 }
 
 TEST_CASE("B-Tree: Find not present key", "[find not present]") {
-  shared_ptr<btree> small = build_small();
-  shared_ptr<btree> node;
+  btree_ptr<> small = build_small();
+  btree<> *node;
 
   node = find(small, 6);
-  REQUIRE(node == small->children[0]);
+  REQUIRE(node == small->child(0));
 
   node = find(small, 15);
-  REQUIRE(node == small->children[1]);
+  REQUIRE(node == small->child(1));
 
   node = find(small, 21);
-  REQUIRE(node == small->children[2]);
+  REQUIRE(node == small->child(2));
   REQUIRE(check_tree(small));
 }
 
+TEST_CASE("B-Tree: Find in an empty tree", "[find empty]") {
+  btree_ptr<> empty;
+  REQUIRE(find(empty, 5) == nullptr);
+  bplus_ptr<> empty_bplus;
+  REQUIRE(find(empty_bplus, 5) == nullptr);
+}
+
 TEST_CASE("B-Tree: Insert key into empty root", "[ins root empty]") {
-  shared_ptr<btree> empty = build_empty();
+  btree_ptr<> empty = build_empty();
   insert(empty, 42);
   REQUIRE(check_tree(empty));
   REQUIRE(private_contains(empty, 42));
 }
 
 TEST_CASE("B-Tree: Insert key into semifull root", "[ins root semifull]") {
-  shared_ptr<btree> semi = build_semifull();
+  btree_ptr<> semi = build_semifull();
   insert(semi, 42);
   REQUIRE(check_tree(semi));
   REQUIRE(private_contains(semi, 10));
@@ -146,7 +158,7 @@ TEST_CASE("B-Tree: Insert key into semifull root", "[ins root semifull]") {
 }
 
 TEST_CASE("B-Tree: Insert key into full root", "[ins root full]") {
-  shared_ptr<btree> full = build_full_leaf_root();
+  btree_ptr<> full = build_full_leaf_root();
   insert(full, 15);
   REQUIRE(check_tree(full));
 
@@ -160,7 +172,7 @@ TEST_CASE("B-Tree: Insert key into full root", "[ins root full]") {
 
 TEST_CASE("B-Tree: Insert key into semifull leaf node", "[ins leaf semifull]") {
   // get a tree with semifull leaf
-  shared_ptr<btree> semi = build_two_tier();
+  btree_ptr<> semi = build_two_tier();
   int height = 0;
   bool leaves_ok = check_height(semi, height);
   REQUIRE(height == 1);
@@ -176,25 +188,25 @@ TEST_CASE("B-Tree: Insert key into semifull leaf node", "[ins leaf semifull]") {
   REQUIRE(leaves_ok);
 
   // check that key is now present
-  REQUIRE(private_contains(semi->children[0], 4));
+  REQUIRE(private_contains(semi->child(0), 4));
 
   insert(semi, 24); // should add to child[2]
   REQUIRE(check_tree(semi));
   leaves_ok = check_height(semi, height);
   REQUIRE(height == 1);
   REQUIRE(leaves_ok);
-  REQUIRE(private_contains(semi->children[2], 24));
+  REQUIRE(private_contains(semi->child(2), 24));
 
   insert(semi, 40); // should add to child[3]
   REQUIRE(check_tree(semi));
   leaves_ok = check_height(semi, height);
   REQUIRE(height == 1);
   REQUIRE(leaves_ok);
-  REQUIRE(private_contains(semi->children[3], 40));
+  REQUIRE(private_contains(semi->child(3), 40));
 }
 
 TEST_CASE("B-Tree: Insert key into full leaf node", "[ins leaf full]") {
-  shared_ptr<btree> semi = build_two_tier();
+  btree_ptr<> semi = build_two_tier();
   int height = 0;
   bool leaves_ok = check_height(semi, height);
   REQUIRE(height == 1);
@@ -213,10 +225,10 @@ TEST_CASE("B-Tree: Insert key into full leaf node", "[ins leaf full]") {
   REQUIRE(private_contains(semi, 17));
 
   // key 15 should be in child[1]
-  REQUIRE(private_contains(semi->children[1], 15));
+  REQUIRE(private_contains(semi->child(1), 15));
 
   // and key 19 shoudl be in child[2]
-  REQUIRE(private_contains(semi->children[2], 19));
+  REQUIRE(private_contains(semi->child(2), 19));
 
   // remember if you're having trouble with this, you can always hack
   // this test file and put some print_tree calls at the trouble
@@ -225,7 +237,7 @@ TEST_CASE("B-Tree: Insert key into full leaf node", "[ins leaf full]") {
 
 TEST_CASE("B-Tree: Remove not present key from empty tree",
           "[rm not present empty]") {
-  shared_ptr<btree> semi = build_empty();
+  btree_ptr<> semi = build_empty();
   remove(semi, 28); // should have no effect
   REQUIRE(check_tree(semi));
   REQUIRE_FALSE(private_contains(semi, 28)); // no idea why this would be the
@@ -233,7 +245,7 @@ TEST_CASE("B-Tree: Remove not present key from empty tree",
 }
 
 TEST_CASE("B-Tree: Remove key from non-empty root", "[rm root not empty]") {
-  shared_ptr<btree> full = build_full_leaf_root();
+  btree_ptr<> full = build_full_leaf_root();
   REQUIRE(private_contains(full, 30));
   remove(full, 30);
   REQUIRE(check_tree(full));
@@ -241,7 +253,7 @@ TEST_CASE("B-Tree: Remove key from non-empty root", "[rm root not empty]") {
 }
 
 TEST_CASE("B-Tree: Remove not present key from leaf", "[rm not present leaf]") {
-  shared_ptr<btree> semi = build_two_tier();
+  btree_ptr<> semi = build_two_tier();
   remove(semi, 28); // should have no effect
   REQUIRE(check_tree(semi));
   REQUIRE_FALSE(private_contains(semi, 28)); // no idea why this would be the
@@ -250,7 +262,7 @@ TEST_CASE("B-Tree: Remove not present key from leaf", "[rm not present leaf]") {
 
 TEST_CASE("B-Tree: Remove key from leaf with full siblings",
           "[rm leaf sibs full]") {
-  shared_ptr<btree> semi = build_two_tier();
+  btree_ptr<> semi = build_two_tier();
   remove(semi, 27); // should cause a rotate right involving parent and sibling to left
   REQUIRE(check_tree(semi));
   
@@ -266,7 +278,7 @@ TEST_CASE("B-Tree: Remove key from leaf with full siblings",
 
 TEST_CASE("B-Tree: Remove key from leaf with at-min-capactiy siblings",
           "[rm leaf sibs mincap]") {
-  shared_ptr<btree> thrice = build_thin_three_tier();
+  btree_ptr<> thrice = build_thin_three_tier();
   int height = 0;
   bool leaves_ok = check_height(thrice, height);
   REQUIRE(height == 2); // just a sanity check
@@ -303,7 +315,7 @@ TEST_CASE("B-Tree: Remove key from leaf with at-min-capactiy siblings",
 }
 
 TEST_CASE("B-Tree: Remove key from internal node with at-min-capacity siblings", "[rm intnl sibs mincap]") {
-  shared_ptr<btree> thrice = build_thin_three_tier();
+  btree_ptr<> thrice = build_thin_three_tier();
   int height = 0;
   bool leaves_ok = check_height(thrice, height);
   REQUIRE(height == 2); // just a sanity check
@@ -324,3 +336,1507 @@ TEST_CASE("B-Tree: Remove key from internal node with at-min-capacity siblings",
   REQUIRE(check_tree(thrice));
   REQUIRE_FALSE(private_search_all(thrice, 24));
 }
+
+// Inserts a scrambled run of keys into an order 'Order' tree, checking
+// the invariants and that every key can be found again.
+template <int Order, typename Search = sorted_search>
+void check_insert_for_order(int n) {
+  btree_ptr<int, Order, Search> root;
+  for (int i = 0; i < n; i++) {
+    insert(root, (i * 7919) % n);
+  }
+  REQUIRE(check_tree(root));
+  REQUIRE(count_keys(root) == n);
+
+  for (int key = 0; key < n; key++) {
+    btree<int, Order, Search> *node = find(root, key);
+    REQUIRE(private_contains(node, key));
+  }
+  REQUIRE_FALSE(private_search_all(root, n));
+
+  // inserting a duplicate is a no-op
+  insert(root, n / 2);
+  REQUIRE(count_keys(root) == n);
+}
+
+TEST_CASE("B-Tree: Insert and find across orders", "[orders]") {
+  SECTION("order 5") { check_insert_for_order<5>(2000); }
+  SECTION("order 16") { check_insert_for_order<16>(2000); }
+  SECTION("order 64") { check_insert_for_order<64>(20000); }
+  SECTION("order 256") { check_insert_for_order<256>(20000); }
+}
+
+TEST_CASE("B-Tree: Sampled search across orders", "[orders][search]") {
+  SECTION("order 5") { check_insert_for_order<5, sampled_search<>>(2000); }
+  SECTION("order 64") { check_insert_for_order<64, sampled_search<>>(20000); }
+  SECTION("order 256") {
+    check_insert_for_order<256, sampled_search<>>(20000);
+  }
+}
+
+TEST_CASE("B-Tree: Eytzinger search across orders", "[orders][search]") {
+  SECTION("order 5") { check_insert_for_order<5, eytzinger_search>(2000); }
+  SECTION("order 64") { check_insert_for_order<64, eytzinger_search>(20000); }
+  SECTION("order 256") {
+    check_insert_for_order<256, eytzinger_search>(20000);
+  }
+}
+
+// Removes every other key from a two level order 16 tree, so the
+// removes borrow from and merge siblings as well as take keys out of
+// leaves, and checks the search index kept up.
+template <typename Search> void check_index_follows_removes() {
+  btree_ptr<int, 16, Search> tree;
+  for (int i = 0; i < 100; i++) {
+    insert(tree, i);
+  }
+  for (int i = 0; i < 100; i += 2) {
+    remove(tree, i);
+  }
+  REQUIRE(check_tree(tree));
+  REQUIRE(count_keys(tree) == 50);
+
+  for (int key = 0; key < 100; key++) {
+    btree<int, 16, Search> *node = find(tree, key);
+    REQUIRE(private_contains(node, key) == (key % 2 == 1));
+  }
+}
+
+TEST_CASE("B-Tree: Search index follows removes", "[search]") {
+  SECTION("sampled") { check_index_follows_removes<sampled_search<>>(); }
+  SECTION("eytzinger") { check_index_follows_removes<eytzinger_search>(); }
+}
+
+// Bulk loads 0..n-1 (as even keys) into an order 'Order' tree at the
+// given fill factor and checks the result is a valid tree holding
+// exactly those keys, which inserts and removes can carry on from.
+template <int Order, typename Search = sorted_search, bool BPlus = false>
+void check_bulk_load(int n, double fill_factor) {
+  vector<int> keys;
+  for (int i = 0; i < n; i++) {
+    keys.push_back(2 * i);
+  }
+
+  btree_ptr<int, Order, Search, void, BPlus> tree;
+  bulk_load(tree, keys.begin(), keys.end(), fill_factor);
+  REQUIRE(check_tree(tree));
+  REQUIRE(count_keys(tree) == n);
+  REQUIRE(tree.live_nodes() == (size_t)count_nodes(tree));
+  for (int key = -1; key < 2 * n; key++) {
+    btree<int, Order, Search, void, BPlus> *node = find(tree, key);
+    REQUIRE(private_contains(node, key) == (key >= 0 && key % 2 == 0));
+  }
+
+  for (int i = 0; i < n; i += 3) {
+    insert(tree, 2 * i + 1);
+  }
+  REQUIRE(check_tree(tree));
+}
+
+TEST_CASE("B-Tree: Bulk load builds a valid tree", "[bulk load]") {
+  SECTION("empty") {
+    btree_ptr<> tree = build_small();
+    vector<int> none;
+    bulk_load(tree, none.begin(), none.end());
+    REQUIRE(tree == nullptr);
+    REQUIRE(tree.live_nodes() == 0);
+  }
+  SECTION("every size around the first few splits") {
+    for (int n = 1; n < 200; n++) {
+      check_bulk_load<5>(n, 1.0);
+      check_bulk_load<5>(n, 0.5);
+      check_bulk_load<16>(n, 0.75);
+    }
+  }
+  SECTION("larger orders and fill factors") {
+    check_bulk_load<16>(20000, 1.0);
+    check_bulk_load<64>(20000, 0.7);
+    check_bulk_load<256>(100000, 0.9);
+    check_bulk_load<64, sampled_search<>>(20000, 1.0);
+    check_bulk_load<64, eytzinger_search>(20000, 1.0);
+  }
+  SECTION("out of range fill factors are clamped") {
+    check_bulk_load<16>(5000, 0.0);
+    check_bulk_load<16>(5000, 2.0);
+  }
+  SECTION("B+ trees") {
+    for (int n = 1; n < 200; n++) {
+      check_bulk_load<5, sorted_search, true>(n, 1.0);
+      check_bulk_load<5, sorted_search, true>(n, 0.5);
+      check_bulk_load<16, sorted_search, true>(n, 0.75);
+    }
+    check_bulk_load<64, sorted_search, true>(20000, 0.7);
+    check_bulk_load<256, sorted_search, true>(100000, 1.0);
+  }
+}
+
+TEST_CASE("B-Tree: Bulk load packs leaves to the fill factor", "[bulk load]") {
+  vector<int> keys;
+  for (int i = 0; i < 63 * 100; i++) {
+    keys.push_back(i);
+  }
+
+  // full leaves: about one node per max_keys keys, and as shallow as
+  // the tree can be
+  btree_ptr<int, 64> packed;
+  bulk_load(packed, keys.begin(), keys.end());
+  int height = 0;
+  REQUIRE(check_height(packed, height));
+  REQUIRE(height == 2);
+  REQUIRE(packed.leaves.live_nodes() <= 100);
+
+  btree_ptr<int, 64> half;
+  bulk_load(half, keys.begin(), keys.end(), 0.5);
+  REQUIRE(check_tree(half));
+  REQUIRE(half.leaves.live_nodes() >= 190);
+  REQUIRE(half.leaves.live_nodes() <= 200);
+
+  // inserting the same keys one at a time leaves nodes about half full
+  btree_ptr<int, 64> inserted;
+  for (int key : keys) {
+    insert(inserted, key);
+  }
+  REQUIRE(packed.live_nodes() < inserted.live_nodes());
+}
+
+// Inserts n scrambled keys in batches of batch_size, checking the
+// tree after every batch and that it ends up holding every key.
+template <int Order, bool BPlus = false>
+void check_insert_batch(int n, int batch_size) {
+  btree_ptr<int, Order, sorted_search, void, BPlus> batched;
+  vector<int> batch;
+  for (int i = 0; i < n; i++) {
+    int key = (i * 7919) % n;
+    batch.push_back(key);
+    // every batch also repeats a key, and one already in the tree
+    batch.push_back(key);
+    batch.push_back((i * 7919) % (i + 1));
+
+    if ((int)batch.size() >= batch_size || i == n - 1) {
+      insert_batch(batched, batch.begin(), batch.end());
+      batch.clear();
+      REQUIRE(check_tree(batched));
+    }
+  }
+
+  REQUIRE(count_keys(batched) == n);
+  for (int key = 0; key < n; key++) {
+    REQUIRE(private_contains(find(batched, key), key));
+  }
+}
+
+TEST_CASE("B-Tree: Insert batch", "[insert batch]") {
+  SECTION("empty batch") {
+    btree_ptr<> tree;
+    vector<int> none;
+    insert_batch(tree, none.begin(), none.end());
+    REQUIRE(tree == nullptr);
+  }
+  SECTION("into a hand-built tree") {
+    btree_ptr<> small = build_small();
+    vector<int> keys = {30, 4, 17, 101, 4, 0, 55, 18, 19, 20, 21, 22};
+    insert_batch(small, keys.begin(), keys.end());
+    REQUIRE(check_tree(small));
+    for (int key : keys) {
+      REQUIRE(private_contains(small, key));
+    }
+  }
+  SECTION("one big batch") { check_insert_batch<5>(3000, 10000); }
+  SECTION("small batches") { check_insert_batch<5>(3000, 10); }
+  SECTION("order 64") { check_insert_batch<64>(50000, 1000); }
+  SECTION("order 256") { check_insert_batch<256>(50000, 5000); }
+  SECTION("B+ tree") {
+    check_insert_batch<5, true>(3000, 10);
+    check_insert_batch<64, true>(50000, 1000);
+  }
+}
+
+#if BTREE_DEBUG_HOOKS
+TEST_CASE("B-Tree: Debug hook sees structural changes", "[debug hook]") {
+  vector<btree_event> events;
+  vector<btree<> *> nodes;
+  auto record = [&](btree_event event, btree<> *node) {
+    events.push_back(event);
+    nodes.push_back(node);
+  };
+
+  SECTION("inserts that split the root") {
+    btree_ptr<> tree;
+    tree.debug_hook = record;
+    for (int i = 0; i < 4; i++) {
+      insert(tree, i);
+    }
+    REQUIRE(events.empty());
+
+    insert(tree, 4);
+    REQUIRE(events.size() == 2);
+    REQUIRE(events[0] == btree_event::split);
+    REQUIRE(events[1] == btree_event::new_root);
+    REQUIRE(nodes[0] == tree->child(0));
+    REQUIRE(nodes[1] == tree.root);
+  }
+
+  SECTION("removes that merge and shrink the tree") {
+    btree_ptr<> thrice = build_thin_three_tier();
+    thrice.debug_hook = record;
+    remove(thrice, 1);
+    REQUIRE(check_tree(thrice));
+    REQUIRE(find(events.begin(), events.end(), btree_event::merge) !=
+            events.end());
+    REQUIRE(events.back() == btree_event::root_collapse);
+    REQUIRE(nodes.back() == thrice.root);
+  }
+
+  SECTION("removes that borrow") {
+    btree_ptr<> tree;
+    for (int i = 8; i >= 0; i--) {
+      insert(tree, i);
+    }
+    // leaves are {0 1 2} {4 5} {7 8}
+    tree.debug_hook = record;
+    remove(tree, 4);
+    REQUIRE(check_tree(tree));
+    REQUIRE(events == vector<btree_event>{btree_event::borrow});
+  }
+
+  SECTION("the hook stays with the tree") {
+    btree_ptr<> tree;
+    tree.debug_hook = record;
+    vector<int> keys = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+    bulk_load(tree, keys.begin(), keys.end());
+    btree_ptr<> moved = std::move(tree);
+    insert(moved, 10);
+    insert(moved, 11);
+    REQUIRE_FALSE(events.empty());
+  }
+}
+#endif
+
+// Applies ops random keys in [0, key_range) to tree and to expected,
+// a set or map kept alongside it: a third of them are removed from
+// both, checking remove agrees about whether the key was there, and
+// the rest are handed to put(key), which adds them to both.
+template <typename Tree, typename Expected, typename Rng, typename Put>
+void random_ops(Tree &tree, Expected &expected, int ops, int key_range,
+                Rng &rng, Put put) {
+  for (int i = 0; i < ops; i++) {
+    int key = (int)(rng() % key_range);
+    if (rng() % 3 == 0) {
+      REQUIRE(remove(tree, key) == (expected.erase(key) == 1));
+    } else {
+      put(key);
+    }
+  }
+}
+
+// random_ops for a set, whose keys go in with insert (checking its
+// result too, for trees whose insert says whether the key was new)
+template <typename Tree, typename Rng>
+void random_ops(Tree &tree, set<int> &expected, int ops, int key_range,
+                Rng &rng) {
+  random_ops(tree, expected, ops, key_range, rng, [&](int key) {
+    if constexpr (is_void<decltype(insert(tree, key))>::value) {
+      insert(tree, key);
+      expected.insert(key);
+    } else {
+      REQUIRE(insert(tree, key) == expected.insert(key).second);
+    }
+  });
+}
+
+// Applies a random mix of inserts and removes to an order 'Order' tree
+// and a std::set side by side, checking remove's result against the
+// set and the tree's invariants as it goes, then removes everything.
+template <int Order, typename Search = sorted_search, bool BPlus = false,
+          typename Summary = no_summary>
+void check_random_removes(int ops, int key_range) {
+  mt19937 rng(Order);
+  btree_ptr<int, Order, Search, void, BPlus, Summary> tree;
+  set<int> expected;
+
+  for (int done = 0; done < ops; done += 97) {
+    random_ops(tree, expected, min(97, ops - done), key_range, rng);
+    REQUIRE(check_tree(tree));
+    REQUIRE(count_keys(tree) == (int)expected.size());
+    REQUIRE(tree.size() == expected.size());
+  }
+  REQUIRE(check_tree(tree));
+  REQUIRE(tree.live_nodes() == (size_t)count_nodes(tree));
+
+  for (int key : expected) {
+    REQUIRE(remove(tree, key));
+    REQUIRE_FALSE(remove(tree, key));
+  }
+  REQUIRE(count_keys(tree) == 0);
+  REQUIRE(tree.live_nodes() == 1);
+}
+
+TEST_CASE("B-Tree: Random inserts and removes", "[remove]") {
+  SECTION("order 5") { check_random_removes<5>(20000, 2000); }
+  SECTION("order 16") { check_random_removes<16>(50000, 5000); }
+  SECTION("order 64") { check_random_removes<64>(50000, 20000); }
+  SECTION("order 64, eytzinger") {
+    check_random_removes<64, eytzinger_search>(20000, 5000);
+  }
+  SECTION("B+ tree, order 5") {
+    check_random_removes<5, sorted_search, true>(20000, 2000);
+  }
+  SECTION("B+ tree, order 16") {
+    check_random_removes<16, sorted_search, true>(50000, 5000);
+  }
+  SECTION("B+ tree, order 64") {
+    check_random_removes<64, sorted_search, true>(50000, 20000);
+  }
+  SECTION("subtree counts") {
+    check_random_removes<5, sorted_search, false, subtree_counts>(20000,
+                                                                  2000);
+    check_random_removes<5, sorted_search, true, subtree_counts>(20000, 2000);
+  }
+}
+
+TEST_CASE("B-Tree: Remove reports whether the key was there", "[remove]") {
+  btree_ptr<> empty;
+  REQUIRE_FALSE(remove(empty, 1));
+
+  btree_ptr<> thrice = build_thin_three_tier();
+  REQUIRE_FALSE(remove(thrice, 2));
+  REQUIRE(count_keys(thrice) == 17);
+  REQUIRE(remove(thrice, 13));
+  REQUIRE(check_tree(thrice));
+  REQUIRE(count_keys(thrice) == 16);
+  REQUIRE_FALSE(private_search_all(thrice, 13));
+}
+
+TEST_CASE("B-Tree: Map keeps a value with each key", "[map]") {
+  btree_map<int, string> tree;
+  REQUIRE(find_value(tree, 1) == nullptr);
+
+  for (int i = 0; i < 2000; i++) {
+    int key = (i * 7919) % 2000;
+    REQUIRE(insert_or_assign(tree, key, to_string(key)));
+  }
+  REQUIRE(check_tree(tree));
+  REQUIRE(count_keys(tree) == 2000);
+
+  // assigning to a key that is there replaces its value
+  for (int key = 0; key < 2000; key += 5) {
+    REQUIRE_FALSE(insert_or_assign(tree, key, "five"));
+  }
+  for (int key = 1; key < 2000; key += 2) {
+    REQUIRE(remove(tree, key));
+  }
+  REQUIRE(check_tree(tree));
+
+  for (int key = 0; key < 2000; key++) {
+    string *value = find_value(tree, key);
+    if (key % 2 == 1) {
+      REQUIRE(value == nullptr);
+    } else {
+      REQUIRE(value != nullptr);
+      REQUIRE(*value == (key % 5 == 0 ? "five" : to_string(key)));
+    }
+  }
+
+  // plain insert gives a new key a default value and leaves an
+  // existing one alone
+  insert(tree, 1);
+  insert(tree, 2);
+  REQUIRE(*find_value(tree, 1) == "");
+  REQUIRE(*find_value(tree, 2) == "2");
+}
+
+TEST_CASE("B-Tree: Map values can be move-only", "[map]") {
+  // unique_ptr values can't be copied, so this only compiles if every
+  // split, merge and borrow moves them
+  btree_map<int, unique_ptr<int>, 16> tree;
+  map<int, int> expected;
+  mt19937 rng(11);
+
+  int next = 0;
+  random_ops(tree, expected, 20000, 3000, rng, [&](int key) {
+    insert_or_assign(tree, key, make_unique<int>(next));
+    expected[key] = next++;
+  });
+  REQUIRE(check_tree(tree));
+  REQUIRE(count_keys(tree) == (int)expected.size());
+
+  for (auto &entry : expected) {
+    unique_ptr<int> *value = find_value(tree, entry.first);
+    REQUIRE(value != nullptr);
+    REQUIRE(*value != nullptr);
+    REQUIRE(**value == entry.second);
+  }
+}
+
+// Walks the leaf chain of a B+ tree both ways and checks it holds
+// exactly the keys in 'expected', in order.
+template <int Order>
+void check_chain(bplus_ptr<int, Order> &tree, const set<int> &expected) {
+  btree<int, Order, sorted_search, void, true> *leaf = tree.root;
+  while (!leaf->is_leaf) {
+    leaf = leaf->child(0);
+  }
+
+  vector<int> forward;
+  btree<int, Order, sorted_search, void, true> *last = leaf;
+  for (; leaf != nullptr; leaf = leaf->next_leaf()) {
+    forward.insert(forward.end(), leaf->keys.begin(),
+                   leaf->keys.begin() + leaf->num_keys);
+    last = leaf;
+  }
+  REQUIRE(forward == vector<int>(expected.begin(), expected.end()));
+
+  vector<int> backward;
+  for (leaf = last; leaf != nullptr; leaf = leaf->prev_leaf()) {
+    for (int i = leaf->num_keys - 1; i >= 0; i--) {
+      backward.push_back(leaf->keys[i]);
+    }
+  }
+  REQUIRE(backward == vector<int>(expected.rbegin(), expected.rend()));
+}
+
+TEST_CASE("B+ Tree: Keys live in the leaves", "[bplus]") {
+  bplus_ptr<> tree;
+  for (int key = 0; key < 100; key++) {
+    insert(tree, key);
+  }
+  REQUIRE(check_tree(tree));
+  REQUIRE(count_keys(tree) == 100);
+
+  // every key, separators included, is found in a leaf
+  for (int key = 0; key < 100; key++) {
+    btree<int, 5, sorted_search, void, true> *node = find(tree, key);
+    REQUIRE(node->is_leaf);
+    REQUIRE(private_contains(node, key));
+  }
+
+  // removing a key that is also a separator leaves a copy behind
+  // that still routes correctly
+  int separator = tree->keys[0];
+  REQUIRE(remove(tree, separator));
+  REQUIRE(check_tree(tree));
+  REQUIRE_FALSE(private_contains(tree, separator));
+  REQUIRE_FALSE(private_contains(find(tree, separator), separator));
+  insert(tree, separator);
+  REQUIRE(check_tree(tree));
+  REQUIRE(private_contains(tree, separator));
+}
+
+TEST_CASE("B+ Tree: Leaves are chained in key order", "[bplus]") {
+  mt19937 rng(12);
+  bplus_ptr<int, 16> tree;
+  set<int> expected;
+  for (int done = 0; done < 20000; done += 1000) {
+    random_ops(tree, expected, 1000, 4000, rng);
+    check_chain(tree, expected);
+  }
+
+  vector<int> sorted(expected.begin(), expected.end());
+  bplus_ptr<int, 16> loaded;
+  bulk_load(loaded, sorted.begin(), sorted.end(), 0.6);
+  check_chain(loaded, expected);
+}
+
+TEST_CASE("B+ Tree: Map keeps a value with each key", "[bplus][map]") {
+  bplus_ptr<int, 5, sorted_search, string> tree;
+  for (int i = 0; i < 2000; i++) {
+    int key = (i * 7919) % 2000;
+    REQUIRE(insert_or_assign(tree, key, to_string(key)));
+  }
+  for (int key = 1; key < 2000; key += 2) {
+    REQUIRE(remove(tree, key));
+  }
+  REQUIRE(check_tree(tree));
+
+  for (int key = 0; key < 2000; key++) {
+    string *value = find_value(tree, key);
+    if (key % 2 == 1) {
+      REQUIRE(value == nullptr);
+    } else {
+      REQUIRE(value != nullptr);
+      REQUIRE(*value == to_string(key));
+    }
+  }
+}
+
+// Fills a tree with random keys, removing some along the way, and
+// checks that iterating over it both ways and every bound query agree
+// with a std::set holding the same keys.
+template <int Order, bool BPlus> void check_iterators(int ops, int key_range) {
+  mt19937 rng(Order + BPlus);
+  btree_ptr<int, Order, sorted_search, void, BPlus> tree;
+  set<int> expected;
+  random_ops(tree, expected, ops, key_range, rng);
+
+  REQUIRE(vector<int>(begin(tree), end(tree)) ==
+          vector<int>(expected.begin(), expected.end()));
+  REQUIRE(vector<int>(rbegin(tree), rend(tree)) ==
+          vector<int>(expected.rbegin(), expected.rend()));
+
+  // stepping back from the end visits every key too
+  auto it = end(tree);
+  for (auto want = expected.rbegin(); want != expected.rend(); ++want) {
+    REQUIRE(*--it == *want);
+  }
+  REQUIRE(it == begin(tree));
+
+  auto matches = [&](decltype(it) got, set<int>::iterator want) {
+    if (want == expected.end()) {
+      return got == end(tree);
+    }
+    return got != end(tree) && *got == *want;
+  };
+  for (int key = -1; key <= key_range; key++) {
+    auto lower = lower_bound(tree, key);
+    REQUIRE(matches(lower, expected.lower_bound(key)));
+    REQUIRE(matches(upper_bound(tree, key), expected.upper_bound(key)));
+
+    auto range = equal_range(tree, key);
+    REQUIRE(range.first == lower);
+    REQUIRE(distance(range.first, range.second) ==
+            (long)expected.count(key));
+  }
+}
+
+TEST_CASE("B-Tree: Iterators walk the keys in order", "[iterator]") {
+  SECTION("empty trees") {
+    btree_ptr<> none;
+    REQUIRE(begin(none) == end(none));
+    REQUIRE(lower_bound(none, 1) == end(none));
+
+    // a root leaf that has had all its keys removed
+    bplus_ptr<> emptied;
+    insert(emptied, 1);
+    remove(emptied, 1);
+    REQUIRE(begin(emptied) == end(emptied));
+    REQUIRE(upper_bound(emptied, 0) == end(emptied));
+  }
+  SECTION("hand-built tree") {
+    btree_ptr<> thrice = build_thin_three_tier();
+    vector<int> keys;
+    for (int key : thrice) {
+      keys.push_back(key);
+    }
+    REQUIRE(keys == vector<int>({1, 3, 4, 5, 6, 7, 11, 12, 13, 14, 16, 17,
+                                 19, 23, 24, 25, 26}));
+    REQUIRE(*lower_bound(thrice, 13) == 13);
+    REQUIRE(*upper_bound(thrice, 13) == 14);
+    REQUIRE(*lower_bound(thrice, 8) == 11);
+    REQUIRE(*--lower_bound(thrice, 14) == 13);
+    REQUIRE(find_if(begin(thrice), end(thrice), [](int key) {
+              return key > 20;
+            }) == lower_bound(thrice, 21));
+  }
+  SECTION("order 5") { check_iterators<5, false>(5000, 1000); }
+  SECTION("order 64") { check_iterators<64, false>(20000, 5000); }
+  SECTION("B+ tree, order 5") { check_iterators<5, true>(5000, 1000); }
+  SECTION("B+ tree, order 64") { check_iterators<64, true>(20000, 5000); }
+  SECTION("map values") {
+    btree_map<int, string> tree;
+    for (int key = 0; key < 100; key++) {
+      insert_or_assign(tree, key, to_string(key));
+    }
+    for (auto it = lower_bound(tree, 50); it != end(tree); ++it) {
+      REQUIRE(it.value() == to_string(*it));
+      it.value() += "!";
+    }
+    REQUIRE(*find_value(tree, 49) == "49");
+    REQUIRE(*find_value(tree, 50) == "50!");
+  }
+}
+
+// Scans random ranges of a random tree, checking the keys that come
+// out against a std::set, and that scan_into fills a buffer the same
+// way.
+template <int Order, bool BPlus> void check_scan(int ops, int key_range) {
+  mt19937 rng(Order * 3 + BPlus);
+  btree_ptr<int, Order, sorted_search, void, BPlus> tree;
+  set<int> expected;
+  for (int i = 0; i < ops; i++) {
+    int key = (int)(rng() % key_range);
+    if (rng() % 4 == 0) {
+      remove(tree, key);
+      expected.erase(key);
+    } else {
+      insert(tree, key);
+      expected.insert(key);
+    }
+  }
+
+  vector<int> buffer(key_range);
+  for (int i = 0; i < 500; i++) {
+    int lo = (int)(rng() % (key_range + 20)) - 10;
+    int hi = lo + (int)(rng() % (key_range / 4));
+    vector<int> want(expected.lower_bound(lo), expected.lower_bound(hi));
+
+    vector<int> got;
+    size_t count = scan(tree, lo, hi, [&](const int *keys, int n) {
+      REQUIRE(n > 0);
+      got.insert(got.end(), keys, keys + n);
+      return true;
+    });
+    REQUIRE(got == want);
+    REQUIRE(count == want.size());
+
+    size_t max = rng() % (want.size() + 2);
+    size_t copied = scan_into(tree, lo, hi, buffer.data(), max);
+    REQUIRE(copied == min(max, want.size()));
+    REQUIRE(equal(buffer.begin(), buffer.begin() + copied, want.begin()));
+  }
+}
+
+TEST_CASE("B-Tree: Scan visits a range of keys", "[scan]") {
+  SECTION("empty tree") {
+    btree_ptr<> none;
+    REQUIRE(scan(none, 0, 100, [](const int *, int) { return true; }) ==
+            0);
+  }
+  SECTION("order 5") { check_scan<5, false>(3000, 1000); }
+  SECTION("order 64") { check_scan<64, false>(20000, 5000); }
+  SECTION("B+ tree, order 5") { check_scan<5, true>(3000, 1000); }
+  SECTION("B+ tree, order 64") { check_scan<64, true>(20000, 5000); }
+  SECTION("stops when the visitor says so") {
+    btree_ptr<int, 16> tree;
+    for (int key = 0; key < 1000; key++) {
+      insert(tree, key);
+    }
+    int runs = 0;
+    size_t count = scan(tree, 100, 900, [&](const int *, int) {
+      return ++runs < 3;
+    });
+    REQUIRE(runs == 3);
+    REQUIRE(count < 800);
+  }
+  SECTION("a B+ tree hands over whole leaves") {
+    vector<int> keys;
+    for (int key = 0; key < 63 * 50; key++) {
+      keys.push_back(key);
+    }
+    bplus_ptr<int, 64> tree;
+    bulk_load(tree, keys.begin(), keys.end());
+    int runs = 0;
+    scan(tree, 0, 63 * 50, [&](const int *, int n) {
+      runs++;
+      return n == 63;
+    });
+    REQUIRE(runs == 50);
+  }
+}
+
+// Checks rank_of and select against a sorted copy of the keys.
+template <typename Tree>
+void check_ranks(Tree &tree, const set<int> &expected, int key_range) {
+  vector<int> sorted(expected.begin(), expected.end());
+  REQUIRE(tree.size() == sorted.size());
+  for (int key = -1; key <= key_range; key++) {
+    size_t want = lower_bound(sorted.begin(), sorted.end(), key) -
+                  sorted.begin();
+    REQUIRE(rank_of(tree, key) == want);
+  }
+  for (size_t k = 0; k < sorted.size(); k++) {
+    REQUIRE(*select(tree, k) == sorted[k]);
+  }
+  REQUIRE(select(tree, sorted.size()) == end(tree));
+}
+
+template <int Order, bool BPlus> void check_order_statistics(int ops) {
+  const int key_range = 4 * ops / 3;
+  mt19937 rng(Order + 7);
+  btree_ptr<int, Order, sorted_search, void, BPlus, subtree_counts> tree;
+  set<int> expected;
+  random_ops(tree, expected, ops, key_range, rng);
+  REQUIRE(check_tree(tree));
+  check_ranks(tree, expected, key_range);
+
+  // the same keys loaded in bulk, then added to in a batch
+  vector<int> sorted(expected.begin(), expected.end());
+  btree_ptr<int, Order, sorted_search, void, BPlus, subtree_counts> loaded;
+  bulk_load(loaded, sorted.begin(), sorted.end(), 0.7);
+  REQUIRE(check_tree(loaded));
+  check_ranks(loaded, expected, key_range);
+
+  vector<int> batch;
+  for (int i = 0; i < ops / 4; i++) {
+    batch.push_back((int)(rng() % key_range));
+  }
+  insert_batch(loaded, batch.begin(), batch.end());
+  expected.insert(batch.begin(), batch.end());
+  REQUIRE(check_tree(loaded));
+  check_ranks(loaded, expected, key_range);
+}
+
+TEST_CASE("B-Tree: Rank and select with subtree counts", "[rank]") {
+  SECTION("empty tree") {
+    btree_ptr<int, 5, sorted_search, void, false, subtree_counts> none;
+    REQUIRE(none.size() == 0);
+    REQUIRE(rank_of(none, 3) == 0);
+    REQUIRE(select(none, 0) == end(none));
+  }
+  SECTION("order 5") { check_order_statistics<5, false>(3000); }
+  SECTION("order 64") { check_order_statistics<64, false>(20000); }
+  SECTION("B+ tree, order 5") { check_order_statistics<5, true>(3000); }
+  SECTION("B+ tree, order 64") { check_order_statistics<64, true>(20000); }
+}
+
+// Checks aggregate over a spread of ranges against a fold over a
+// sorted copy of the entries.
+template <typename Tree, typename Monoid>
+void check_aggregates(Tree &tree, const map<int, long> &expected,
+                      int key_range, mt19937 &rng) {
+  for (int i = 0; i < 500; i++) {
+    int lo = (int)(rng() % (key_range + 2)) - 1;
+    int hi = lo + (int)(rng() % (i % 2 == 0 ? 8 : key_range));
+    size_t count = 0;
+    long want = Monoid::identity();
+    for (auto it = expected.lower_bound(lo);
+         it != expected.end() && it->first < hi; ++it) {
+      count++;
+      want = Monoid::combine(want, it->second);
+    }
+    auto got = aggregate(tree, lo, hi);
+    REQUIRE(got.count == count);
+    REQUIRE(got.value == want);
+  }
+  auto all = aggregate(tree, -1, key_range);
+  REQUIRE(all.count == expected.size());
+
+  // an empty or backwards range holds nothing
+  REQUIRE(aggregate(tree, 5, 5).count == 0);
+  REQUIRE(aggregate(tree, 9, 2).value == Monoid::identity());
+}
+
+template <int Order, bool BPlus> void check_range_aggregates(int ops) {
+  const int key_range = 4 * ops / 3;
+  mt19937 rng(Order + 13);
+
+  // sums of the keys of a set
+  btree_ptr<int, Order, sorted_search, void, BPlus,
+            monoid_summary<sum_of<long>>>
+      keys;
+  map<int, long> expected_keys;
+  random_ops(keys, expected_keys, ops, key_range, rng, [&](int key) {
+    insert(keys, key);
+    expected_keys[key] = key;
+  });
+  REQUIRE(check_tree(keys));
+  check_aggregates<decltype(keys), sum_of<long>>(keys, expected_keys,
+                                                 key_range, rng);
+
+  // the largest value in a map, with values reassigned as it goes
+  btree_ptr<int, Order, sorted_search, long, BPlus,
+            monoid_summary<max_of<long>>>
+      values;
+  map<int, long> expected_values;
+  for (int i = 0; i < ops; i++) {
+    int key = (int)(rng() % key_range);
+    long value = (long)(rng() % 100000);
+    if (rng() % 4 == 0) {
+      remove(values, key);
+      expected_values.erase(key);
+    } else {
+      insert_or_assign(values, key, value);
+      expected_values[key] = value;
+    }
+  }
+  REQUIRE(check_tree(values));
+  check_aggregates<decltype(values), max_of<long>>(values, expected_values,
+                                                   key_range, rng);
+
+  // Values a summary depends on can only be read in place.
+  static_assert(
+      is_same<decltype(find_value(values, 0)), const long *>::value, "");
+  static_assert(
+      is_same<decltype(begin(values).value()), const long &>::value, "");
+  btree_map<int, long> plain;
+  static_assert(is_same<decltype(find_value(plain, 0)), long *>::value, "");
+  static_assert(is_same<decltype(begin(plain).value()), long &>::value, "");
+}
+
+TEST_CASE("B-Tree: Aggregates over a range of keys", "[aggregate]") {
+  SECTION("range counts") {
+    btree_ptr<int, 5, sorted_search, void, false, subtree_counts> tree;
+    for (int key = 0; key < 1000; key += 2) {
+      insert(tree, key);
+    }
+    REQUIRE(aggregate(tree, 0, 1000) == 500);
+    REQUIRE(aggregate(tree, 10, 20) == 5);
+    REQUIRE(aggregate(tree, 11, 21) == 5);
+    REQUIRE(aggregate(tree, 11, 12) == 0);
+    REQUIRE(aggregate(tree, -50, 3) == 2);
+  }
+  SECTION("minimum of the keys") {
+    btree_ptr<int, 5, sorted_search, void, false,
+              monoid_summary<min_of<long>>>
+        tree;
+    REQUIRE(aggregate(tree, 0, 10).count == 0);
+    for (int key = 1000; key > 0; key -= 3) {
+      insert(tree, key);
+    }
+    REQUIRE(aggregate(tree, 0, 1001).value == 1);
+    REQUIRE(aggregate(tree, 500, 600).value == 502);
+    REQUIRE(rank_of(tree, 502) == 167);
+  }
+  SECTION("order 5") { check_range_aggregates<5, false>(3000); }
+  SECTION("order 16") { check_range_aggregates<16, false>(20000); }
+  SECTION("B+ tree, order 5") { check_range_aggregates<5, true>(3000); }
+  SECTION("B+ tree, order 16") { check_range_aggregates<16, true>(20000); }
+}
+
+template <int Order, bool BPlus> void check_contains_batch(int keys) {
+  mt19937 rng(Order + 17);
+  btree_ptr<int, Order, sorted_search, void, BPlus> tree;
+  set<int> expected;
+  for (int i = 0; i < keys; i++) {
+    int key = (int)(rng() % (2 * keys));
+    insert(tree, key);
+    expected.insert(key);
+  }
+
+  // a length that is neither a whole number of groups nor of words
+  vector<int> lookups(3 * keys + 37);
+  for (int &key : lookups) {
+    key = (int)(rng() % (2 * keys + 10)) - 5;
+  }
+  vector<uint64_t> found((lookups.size() + 63) / 64, ~uint64_t(0));
+  contains_batch(tree, lookups.data(), lookups.size(), found.data());
+  for (size_t i = 0; i < lookups.size(); i++) {
+    bool bit = (found[i / 64] >> (i % 64)) & 1;
+    REQUIRE(bit == (expected.count(lookups[i]) == 1));
+  }
+}
+
+TEST_CASE("B-Tree: Batched lookups", "[batch]") {
+  SECTION("empty tree") {
+    btree_ptr<> tree;
+    int keys[] = {1, 2, 3};
+    uint64_t found = ~uint64_t(0);
+    contains_batch(tree, keys, 3, &found);
+    REQUIRE(found == 0);
+  }
+  SECTION("order 5") { check_contains_batch<5, false>(2000); }
+  SECTION("order 64") { check_contains_batch<64, false>(20000); }
+  SECTION("B+ tree, order 5") { check_contains_batch<5, true>(2000); }
+  SECTION("B+ tree, order 64") { check_contains_batch<64, true>(20000); }
+}
+
+#ifdef __cpp_impl_coroutine
+template <int Order, bool BPlus> void check_interleaved(int keys, int width) {
+  mt19937 rng(Order + width);
+  btree_ptr<int, Order, sorted_search, void, BPlus> tree;
+  set<int> expected;
+  for (int i = 0; i < keys; i++) {
+    int key = (int)(rng() % (2 * keys));
+    insert(tree, key);
+    expected.insert(key);
+  }
+
+  vector<int> lookups(3 * keys + 37);
+  for (int &key : lookups) {
+    key = (int)(rng() % (2 * keys + 10)) - 5;
+  }
+  vector<uint64_t> found((lookups.size() + 63) / 64, ~uint64_t(0));
+  contains_interleaved(tree, lookups.data(), lookups.size(), found.data(),
+                       width);
+  for (size_t i = 0; i < lookups.size(); i++) {
+    bool bit = (found[i / 64] >> (i % 64)) & 1;
+    REQUIRE(bit == (expected.count(lookups[i]) == 1));
+  }
+}
+
+TEST_CASE("B-Tree: Interleaved coroutine lookups", "[batch]") {
+  SECTION("empty tree") {
+    btree_ptr<> tree;
+    int keys[] = {1, 2, 3};
+    uint64_t found = ~uint64_t(0);
+    contains_interleaved(tree, keys, 3, &found, 8);
+    REQUIRE(found == 0);
+  }
+  SECTION("one at a time") { check_interleaved<5, false>(2000, 1); }
+  SECTION("order 5, width 3") { check_interleaved<5, false>(2000, 3); }
+  SECTION("order 64, width 16") { check_interleaved<64, false>(20000, 16); }
+  SECTION("B+ tree, width 7") { check_interleaved<5, true>(2000, 7); }
+  SECTION("B+ tree, order 64, width 32") {
+    check_interleaved<64, true>(20000, 32);
+  }
+}
+#endif
+
+// Inserts keys through one finger and checks the tree against a set,
+// then looks every key up through another.
+template <int Order, bool BPlus>
+void check_fingers(const vector<int> &keys, int key_range) {
+  btree_ptr<int, Order, sorted_search, void, BPlus, subtree_counts> tree;
+  typename decltype(tree)::finger hint;
+  set<int> expected;
+  for (int key : keys) {
+    REQUIRE(insert_near(tree, hint, key) == expected.insert(key).second);
+  }
+  REQUIRE(check_tree(tree));
+  REQUIRE(tree.size() == expected.size());
+  REQUIRE(vector<int>(begin(tree), end(tree)) ==
+          vector<int>(expected.begin(), expected.end()));
+
+  typename decltype(tree)::finger lookup;
+  for (int key = -1; key <= key_range; key++) {
+    auto *node = find_near(tree, lookup, key);
+    REQUIRE(node == find(tree, key));
+    REQUIRE(lookup.leaf()->is_leaf);
+  }
+}
+
+template <int Order, bool BPlus> void check_finger_orders() {
+  const int n = 5000;
+  mt19937 rng(Order + 19);
+
+  vector<int> increasing(n);
+  for (int i = 0; i < n; i++) {
+    increasing[i] = 3 * i;
+  }
+  check_fingers<Order, BPlus>(increasing, 3 * n);
+
+  vector<int> decreasing(increasing.rbegin(), increasing.rend());
+  check_fingers<Order, BPlus>(decreasing, 3 * n);
+
+  // mostly increasing, with some going back and some repeated
+  vector<int> near(n);
+  for (int i = 0; i < n; i++) {
+    near[i] = 2 * i + (int)(rng() % 40) - 20;
+  }
+  check_fingers<Order, BPlus>(near, 2 * n + 20);
+
+  vector<int> random(n);
+  for (int &key : random) {
+    key = (int)(rng() % n);
+  }
+  check_fingers<Order, BPlus>(random, n);
+}
+
+TEST_CASE("B-Tree: Inserts and finds near a finger", "[finger]") {
+  SECTION("empty tree") {
+    btree_ptr<> tree;
+    btree_ptr<>::finger hint;
+    REQUIRE(find_near(tree, hint, 4) == nullptr);
+    REQUIRE(insert_near(tree, hint, 4));
+    REQUIRE_FALSE(insert_near(tree, hint, 4));
+    REQUIRE(find_near(tree, hint, 4) == tree.root);
+  }
+  SECTION("a finger from another tree is ignored") {
+    btree_ptr<> a, b;
+    btree_ptr<>::finger hint;
+    for (int key = 0; key < 100; key++) {
+      insert_near(a, hint, key);
+    }
+    insert(b, 7);
+    REQUIRE(insert_near(b, hint, 100));
+    REQUIRE(count_keys(b) == 2);
+    REQUIRE(count_keys(a) == 100);
+  }
+  SECTION("order 5") { check_finger_orders<5, false>(); }
+  SECTION("order 64") { check_finger_orders<64, false>(); }
+  SECTION("B+ tree, order 5") { check_finger_orders<5, true>(); }
+  SECTION("B+ tree, order 64") { check_finger_orders<64, true>(); }
+}
+
+// Appends n increasing keys and checks that the nodes they leave
+// behind are nearly full, then mixes in other inserts and removes.
+template <int Order, bool BPlus> void check_appends(int n) {
+  btree_ptr<int, Order, sorted_search, void, BPlus, subtree_counts> tree;
+  for (int i = 0; i < n; i++) {
+    insert(tree, 2 * i);
+  }
+  REQUIRE(check_tree(tree));
+  REQUIRE(tree.size() == (size_t)n);
+  REQUIRE(tree.tail.path.depth > 0);
+  // a node split at the end keeps all but one of its keys
+  const int max_keys = btree<int, Order>::max_keys;
+  double fill = (double)count_keys(tree) / (count_nodes(tree) * max_keys);
+  REQUIRE(fill > 1 - 1.5 / max_keys);
+
+  // the odd keys land all over the tree, and the removes merge and
+  // borrow, including along the right edge
+  mt19937 rng(Order + 23);
+  set<int> expected;
+  for (int i = 0; i < n; i++) {
+    expected.insert(2 * i);
+  }
+  int top = 2 * n;
+  for (int i = 0; i < n; i++) {
+    int key = (int)(rng() % top);
+    switch (rng() % 3) {
+    case 0:
+      insert(tree, key | 1);
+      expected.insert(key | 1);
+      break;
+    case 1:
+      remove(tree, key);
+      expected.erase(key);
+      break;
+    default:
+      insert(tree, top);
+      expected.insert(top);
+      top += 2;
+    }
+  }
+  REQUIRE(check_tree(tree));
+  REQUIRE(tree.size() == expected.size());
+  REQUIRE(vector<int>(begin(tree), end(tree)) ==
+          vector<int>(expected.begin(), expected.end()));
+
+  for (int key : vector<int>(expected.begin(), expected.end())) {
+    remove(tree, key);
+  }
+  REQUIRE(check_tree(tree));
+  REQUIRE(tree.size() == 0);
+}
+
+TEST_CASE("B-Tree: Appends fill nodes", "[append]") {
+  SECTION("order 5") { check_appends<5, false>(3000); }
+  SECTION("order 16") { check_appends<16, false>(20000); }
+  SECTION("order 64") { check_appends<64, false>(20000); }
+  SECTION("B+ tree, order 5") { check_appends<5, true>(3000); }
+  SECTION("B+ tree, order 64") { check_appends<64, true>(20000); }
+}
+
+// Runs random inserts and removes on a concurrent tree (a
+// concurrent_btree or blink_btree) from one thread against a set.
+template <typename Tree> void check_concurrent_alone(int ops) {
+  Tree tree;
+  set<int> expected;
+  mt19937 rng(Tree::node_type::order + 29);
+  const int key_range = 4 * ops / 3;
+  random_ops(tree, expected, ops, key_range, rng);
+  REQUIRE(check_tree(tree));
+  for (int key = -1; key <= key_range; key++) {
+    REQUIRE(contains(tree, key) == (expected.count(key) == 1));
+  }
+}
+
+// Each of several threads inserts and removes its own keys (those
+// equal to its number, mod the number of threads) and reads them back,
+// while keys below zero are put in first and must stay visible to
+// every thread throughout.
+template <typename Tree> void check_concurrent_threads(int threads, int ops) {
+  Tree tree;
+  const int fixed = 500;
+  for (int key = -fixed; key < 0; key++) {
+    insert(tree, key);
+  }
+
+  vector<set<int>> owned(threads);
+  vector<int> mistakes(threads, 0);
+  vector<thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      mt19937 rng(t + 31);
+      set<int> &mine = owned[t];
+      for (int i = 0; i < ops; i++) {
+        int key = (int)(rng() % (ops / 2)) * threads + t;
+        switch (rng() % 4) {
+        case 0:
+          mistakes[t] += remove(tree, key) != (mine.erase(key) == 1);
+          break;
+        case 1:
+          mistakes[t] += contains(tree, key) != (mine.count(key) == 1);
+          mistakes[t] += !contains(tree, -1 - (int)(rng() % fixed));
+          break;
+        default:
+          mistakes[t] += insert(tree, key) != mine.insert(key).second;
+        }
+      }
+    });
+  }
+  for (thread &worker : workers) {
+    worker.join();
+  }
+
+  REQUIRE(check_tree(tree));
+  size_t total = fixed;
+  for (int t = 0; t < threads; t++) {
+    REQUIRE(mistakes[t] == 0);
+    total += owned[t].size();
+    for (int key : owned[t]) {
+      REQUIRE(contains(tree, key));
+    }
+  }
+  REQUIRE(tree.size() == total);
+}
+
+TEST_CASE("B-Tree: Concurrent tree with latch crabbing", "[concurrent]") {
+  SECTION("empty tree") {
+    concurrent_btree<int, 5> tree;
+    REQUIRE_FALSE(contains(tree, 1));
+    REQUIRE_FALSE(remove(tree, 1));
+    REQUIRE(check_tree(tree));
+    // Only an optimistic tree needs an epoch_reclaimer.
+    static_assert(is_same<decltype(tree.reclaimer), no_reclaimer>::value, "");
+  }
+  SECTION("one thread, order 5") {
+    check_concurrent_alone<concurrent_btree<int, 5>>(5000);
+  }
+  SECTION("one thread, order 64") {
+    check_concurrent_alone<concurrent_btree<int, 64>>(50000);
+  }
+  SECTION("four threads, order 5") {
+    check_concurrent_threads<concurrent_btree<int, 5>>(4, 20000);
+  }
+  SECTION("eight threads, order 64") {
+    check_concurrent_threads<concurrent_btree<int, 64>>(8, 20000);
+  }
+}
+
+TEST_CASE("B-Tree: Concurrent tree with optimistic lock coupling",
+          "[optimistic]") {
+  SECTION("empty tree") {
+    concurrent_btree<int, 5, true> tree;
+    REQUIRE_FALSE(contains(tree, 1));
+    REQUIRE_FALSE(remove(tree, 1));
+    REQUIRE(check_tree(tree));
+  }
+  SECTION("one thread, order 5") {
+    check_concurrent_alone<concurrent_btree<int, 5, true>>(5000);
+  }
+  SECTION("one thread, order 64") {
+    check_concurrent_alone<concurrent_btree<int, 64, true>>(50000);
+  }
+  SECTION("four threads, order 5") {
+    check_concurrent_threads<concurrent_btree<int, 5, true>>(4, 20000);
+  }
+  SECTION("eight threads, order 64") {
+    check_concurrent_threads<concurrent_btree<int, 64, true>>(8, 20000);
+  }
+}
+
+// tracked counts how many of it are alive, to see when a reclaimer
+// frees them.
+struct tracked {
+  static inline int alive = 0;
+  tracked() { alive++; }
+  ~tracked() { alive--; }
+};
+
+TEST_CASE("B-Tree: Epoch-based reclamation", "[epoch]") {
+  SECTION("with no guard, retired nodes go after two epochs") {
+    epoch_reclaimer reclaimer;
+    for (int i = 0; i < 10; i++) {
+      reclaimer.retire(new tracked);
+    }
+    REQUIRE(reclaimer.current_epoch() == 10);
+    REQUIRE(reclaimer.retired_count() == 1);
+    REQUIRE(tracked::alive == 1);
+  }
+  REQUIRE(tracked::alive == 0);
+
+  SECTION("a guard holds back everything retired while it lives") {
+    epoch_reclaimer reclaimer;
+    reclaimer.retire(new tracked);
+    {
+      epoch_guard guard(reclaimer);
+      for (int i = 0; i < 10; i++) {
+        reclaimer.retire(new tracked);
+      }
+      // The epoch moves one past the guard's, and no further.
+      REQUIRE(reclaimer.current_epoch() == 2);
+      REQUIRE(tracked::alive == 10);
+    }
+    reclaimer.retire(new tracked);
+    reclaimer.retire(new tracked);
+    REQUIRE(tracked::alive == 1);
+  }
+  REQUIRE(tracked::alive == 0);
+
+  SECTION("a guard on another thread") {
+    epoch_reclaimer reclaimer;
+    atomic<int> stage{0};
+    thread reader([&] {
+      epoch_guard guard(reclaimer);
+      stage = 1;
+      while (stage != 2) {
+        this_thread::yield();
+      }
+    });
+    while (stage != 1) {
+      this_thread::yield();
+    }
+    for (int i = 0; i < 10; i++) {
+      reclaimer.retire(new tracked);
+    }
+    REQUIRE(tracked::alive == 10);
+    stage = 2;
+    reader.join();
+    reclaimer.retire(new tracked);
+    reclaimer.retire(new tracked);
+    REQUIRE(tracked::alive == 1);
+  }
+  REQUIRE(tracked::alive == 0);
+
+  SECTION("threads that have exited hand their slots back") {
+    epoch_reclaimer reclaimer;
+    for (int i = 0; i < 4; i++) {
+      thread([&] { epoch_guard guard(reclaimer); }).join();
+    }
+    REQUIRE(reclaimer.slot_count() == 1);
+
+    atomic<int> entered{0};
+    vector<thread> readers;
+    for (int i = 0; i < 3; i++) {
+      readers.emplace_back([&] {
+        epoch_guard guard(reclaimer);
+        entered++;
+        while (entered != 3) {
+          this_thread::yield();
+        }
+      });
+    }
+    for (thread &reader : readers) {
+      reader.join();
+    }
+    REQUIRE(reclaimer.slot_count() == 3);
+  }
+
+  SECTION("a thread forgets the slots of reclaimers that have gone") {
+    thread([] {
+      for (int i = 0; i < 5; i++) {
+        epoch_reclaimer reclaimer;
+        epoch_guard guard(reclaimer);
+        REQUIRE(epoch_reclaimer::cached_slots() == 1);
+      }
+    }).join();
+  }
+
+  SECTION("an optimistic tree frees the nodes it merges away") {
+    concurrent_btree<int, 5, true> tree;
+    for (int key = 0; key < 5000; key++) {
+      insert(tree, key);
+    }
+    for (int key = 0; key < 5000; key++) {
+      REQUIRE(remove(tree, key));
+    }
+    REQUIRE(check_tree(tree));
+    REQUIRE(tree.reclaimer.retired_count() <= 2);
+  }
+}
+
+TEST_CASE("B-Tree: B-link tree with right links", "[concurrent][blink]") {
+  SECTION("empty tree") {
+    blink_btree<int, 5> tree;
+    REQUIRE_FALSE(contains(tree, 1));
+    REQUIRE_FALSE(remove(tree, 1));
+    REQUIRE(check_tree(tree));
+  }
+  SECTION("leaves can empty without merging") {
+    blink_btree<int, 5> tree;
+    for (int key = 0; key < 100; key++) {
+      insert(tree, key);
+    }
+    for (int key = 0; key < 100; key += 2) {
+      REQUIRE(remove(tree, key));
+    }
+    for (int key = 20; key < 60; key++) {
+      remove(tree, key);
+    }
+    REQUIRE(check_tree(tree));
+    REQUIRE(tree.size() == 30);
+    for (int key = 0; key < 100; key++) {
+      REQUIRE(contains(tree, key) == (key % 2 == 1 && (key < 20 || key >= 60)));
+    }
+    REQUIRE(insert(tree, 40));
+    REQUIRE(contains(tree, 40));
+  }
+  SECTION("one thread, order 5") {
+    check_concurrent_alone<blink_btree<int, 5>>(5000);
+  }
+  SECTION("one thread, order 64") {
+    check_concurrent_alone<blink_btree<int, 64>>(50000);
+  }
+  SECTION("four threads, order 5") {
+    check_concurrent_threads<blink_btree<int, 5>>(4, 20000);
+  }
+  SECTION("eight threads, order 64") {
+    check_concurrent_threads<blink_btree<int, 64>>(8, 20000);
+  }
+}
+
+// Runs random inserts and removes on a persistent tree against a set,
+// taking a snapshot (and a copy of the set) every so often, and checks
+// at the end that every snapshot still holds what it held when taken.
+template <int Order> void check_persistent(int ops) {
+  persistent_btree<int, Order> tree;
+  set<int> expected;
+  vector<pair<persistent_btree<int, Order>, set<int>>> snapshots;
+  mt19937 rng(Order + 37);
+  const int key_range = 4 * ops / 3;
+  for (int done = 0; done < ops; done += ops / 10) {
+    random_ops(tree, expected, min(ops / 10, ops - done), key_range, rng);
+    snapshots.emplace_back(tree.snapshot(), expected);
+  }
+
+  for (auto &[snapshot, keys] : snapshots) {
+    REQUIRE(check_tree(snapshot));
+    REQUIRE(snapshot.size() == keys.size());
+    vector<int> seen;
+    scan(snapshot, -1, key_range + 1, [&](const int *run, int n) {
+      seen.insert(seen.end(), run, run + n);
+      return true;
+    });
+    REQUIRE(seen == vector<int>(keys.begin(), keys.end()));
+  }
+  for (int key = -1; key <= key_range; key++) {
+    REQUIRE(contains(tree, key) == (expected.count(key) == 1));
+  }
+}
+
+TEST_CASE("B-Tree: Persistent tree with snapshots", "[persistent]") {
+  SECTION("empty tree") {
+    persistent_btree<int, 5> tree;
+    REQUIRE_FALSE(contains(tree, 1));
+    REQUIRE_FALSE(remove(tree, 1));
+    REQUIRE(check_tree(tree));
+    REQUIRE(insert(tree, 1));
+    REQUIRE(remove(tree, 1));
+    REQUIRE(tree.root == nullptr);
+  }
+  SECTION("a change copies one path and shares the rest") {
+    persistent_btree<int, 5> tree;
+    for (int key = 0; key < 1000; key++) {
+      insert(tree, key);
+    }
+    auto before = tree.snapshot();
+    REQUIRE(before.root == tree.root);
+    REQUIRE(insert(tree, 1000));
+    REQUIRE(tree.root != before.root);
+    REQUIRE_FALSE(contains(before, 1000));
+    REQUIRE(before.size() == 1000);
+
+    // Only the child of the root on the path to 1000 (the last one)
+    // is new.
+    int shared = 0;
+    for (int i = 0; i <= before.root->num_keys; i++) {
+      shared += tree.root->child(i) == before.root->child(i);
+    }
+    REQUIRE(tree.root->num_keys == before.root->num_keys);
+    REQUIRE(shared == before.root->num_keys);
+
+    REQUIRE(remove(tree, 0));
+    REQUIRE(contains(before, 0));
+    REQUIRE(check_tree(before));
+    REQUIRE(check_tree(tree));
+  }
+  SECTION("scan stops when the visitor says so") {
+    persistent_btree<int, 5> tree;
+    for (int key = 0; key < 100; key++) {
+      insert(tree, key);
+    }
+    int total = 0;
+    size_t handed = scan(tree, 10, 90, [&](const int *, int n) {
+      total += n;
+      return total < 20;
+    });
+    REQUIRE(total >= 20);
+    REQUIRE(handed == (size_t)total);
+    REQUIRE(scan(tree, 50, 50, [](const int *, int) { return true; }) == 0);
+    REQUIRE(scan(tree, 95, 200, [](const int *, int) { return true; }) == 5);
+  }
+  SECTION("order 5") { check_persistent<5>(5000); }
+  SECTION("order 64") { check_persistent<64>(50000); }
+}
+
+TEST_CASE("B-Tree: Larger orders give shallower trees", "[orders]") {
+  btree_ptr<int, 5> narrow;
+  btree_ptr<int, 64> wide;
+  for (int i = 0; i < 5000; i++) {
+    insert(narrow, i);
+    insert(wide, i);
+  }
+
+  int narrow_height = 0, wide_height = 0;
+  REQUIRE(check_height(narrow, narrow_height));
+  REQUIRE(check_height(wide, wide_height));
+  REQUIRE(wide_height < narrow_height);
+  REQUIRE(count_nodes(wide) < count_nodes(narrow));
+
+  REQUIRE((btree<int, 64>::max_keys == 63));
+  REQUIRE((btree<int, 64>::min_keys == 31));
+  REQUIRE((btree<int, 5>::min_keys == 2));
+}
+
+TEST_CASE("B-Tree: Nodes live in the tree's arena", "[arena]") {
+  btree_ptr<int, 16> tree;
+  for (int i = 0; i < 5000; i++) {
+    insert(tree, i);
+  }
+  REQUIRE(check_tree(tree));
+  REQUIRE(tree.live_nodes() == (size_t)count_nodes(tree));
+  REQUIRE(tree.leaves.slab_count() < tree.leaves.live_nodes());
+
+  // moving the handle keeps the nodes where they are
+  btree<int, 16> *old_root = tree.root;
+  btree_ptr<int, 16> moved = std::move(tree);
+  REQUIRE(tree == nullptr);
+  REQUIRE(moved.root == old_root);
+  REQUIRE(count_keys(moved) == 5000);
+
+  // merged-away nodes go back to the arena
+  btree_ptr<> thrice = build_thin_three_tier();
+  remove(thrice, 1);
+  REQUIRE(check_tree(thrice));
+  REQUIRE(thrice.live_nodes() == (size_t)count_nodes(thrice));
+}
+
+TEST_CASE("B-Tree: Leaves don't carry a children array", "[node types]") {
+  // a leaf is just the shared header and its keys
+  REQUIRE(sizeof(btree_leaf<int, 16>) == sizeof(btree<int, 16>));
+  REQUIRE(sizeof(btree_leaf<int, 16>) < sizeof(btree_internal<int, 16>) / 2);
+
+  btree_ptr<int, 16> tree;
+  for (int i = 0; i < 5000; i++) {
+    insert(tree, (i * 7919) % 5000);
+  }
+  REQUIRE(check_tree(tree));
+  REQUIRE(tree.leaves.live_nodes() > 8 * tree.internals.live_nodes());
+
+  // walking down child(0) ends at the leaf holding the smallest key
+  btree<int, 16> *node = tree.root;
+  while (!node->is_leaf) {
+    node = node->child(0);
+  }
+  REQUIRE(node == find(tree, 0));
+}
+
+// Compares search_keys and the search policies against a plain linear
+// count for every key count up to n and for targets below, between, on
+// and above the keys.
+template <typename Key> void check_search_against_scan(int n) {
+  sorted_search::node_index<Key, 128> sorted;
+  sampled_search<4>::node_index<Key, 128> sampled{};
+  eytzinger_search::node_index<Key, 128> eytzinger{};
+  vector<Key> keys;
+  for (int i = 0; i < n; i++) {
+    keys.push_back((Key)(i * 3 - n));
+  }
+
+  for (int len = 0; len <= n; len++) {
+    sampled_search<4>::rebuild(sampled, keys.data(), len);
+    eytzinger_search::rebuild(eytzinger, keys.data(), len);
+    for (int t = -n - 2; t < 2 * n + 2; t++) {
+      Key target = (Key)t;
+      int expected = 0;
+      while (expected < len && keys[expected] < target) {
+        expected++;
+      }
+      REQUIRE(search_keys(keys.data(), len, target) == expected);
+      REQUIRE(search_keys_scalar(keys.data(), len, target) == expected);
+      REQUIRE(sorted_search::search(sorted, keys.data(), len, target) ==
+              expected);
+      REQUIRE(sampled_search<4>::search(sampled, keys.data(), len, target) ==
+              expected);
+      REQUIRE(eytzinger_search::search(eytzinger, keys.data(), len, target) ==
+              expected);
+    }
+  }
+}
+
+TEST_CASE("B-Tree: In-node search matches a linear scan", "[search]") {
+  SECTION("int32 keys") { check_search_against_scan<int32_t>(80); }
+  SECTION("int64 keys") { check_search_against_scan<int64_t>(80); }
+  SECTION("double keys") { check_search_against_scan<double>(40); }
+}
@@ -7,8 +7,8 @@
 
 #include "btree_unittest_help.h"
 #include "btree.h"
-#include <climits>
 #include <cmath>
+#include <limits>
 #include <memory>
 #include <sstream>
 #include <string>
@@ -16,173 +16,176 @@
 
 using namespace std;
 
-shared_ptr<btree> init_node() {
-  shared_ptr<btree> ret = make_shared<btree>();
+btree<> *init_node(btree_ptr<> &tree, bool is_leaf) {
+  btree<> *ret = is_leaf ? tree.new_leaf() : tree.new_internal();
   return ret;
 }
 
-shared_ptr<btree> build_broken() {
+btree_ptr<> build_broken() {
 
+  btree_ptr<> tree;
   int vals[] = {10, 20};
-  shared_ptr<btree> root = build_node(2, vals);
+  btree<> *root = tree.root = build_node(tree, 2, vals, false);
   // now we need three children
   int vals2[] = {2, 8};
-  shared_ptr<btree> left = build_node(2, vals2);
-  int vals3[] = {13, 17};
-  shared_ptr<btree> mid = build_node(2, vals3);
-  int vals4[] = {28};
-  shared_ptr<btree> right =
-      build_node(1, vals4); // right node is under capacity!
-  root->is_leaf = false;
-  root->children[0] = left;
-  root->children[1] = mid;
-  root->children[2] = right;
-  return root;
-}
-
-shared_ptr<btree> build_semifull() {
+  btree<> *left = build_node(tree, 2, vals2);
+  int vals3[] = {13};
+  btree<> *mid = build_node(tree, 1, vals3); // mid node is under capacity!
+  int vals4[] = {24, 28};
+  btree<> *right = build_node(tree, 2, vals4);
+  root->child(0) = left;
+  root->child(1) = mid;
+  root->child(2) = right;
+  return tree;
+}
+
+btree_ptr<> build_semifull() {
+  btree_ptr<> tree;
   int vals[] = {10, 30};
-  shared_ptr<btree> root = build_node(2, vals);
+  btree<> *root = tree.root = build_node(tree, 2, vals);
   root->num_keys = 2;
-  return root;
+  return tree;
 }
 
-shared_ptr<btree> build_empty() { return init_node(); }
+btree_ptr<> build_empty() {
+  btree_ptr<> tree;
+  tree.root = init_node(tree, true);
+  return tree;
+}
 
-shared_ptr<btree> build_full_leaf_root() {
+btree_ptr<> build_full_leaf_root() {
+  btree_ptr<> tree;
   int vals[] = {10, 20, 30, 40};
-  shared_ptr<btree> root = build_node(4, vals);
+  btree<> *root = tree.root = build_node(tree, 4, vals);
   root->num_keys = 4;
-  return root;
+  return tree;
 }
 
-shared_ptr<btree> build_small() {
+btree_ptr<> build_small() {
   //       root
   //      10   20
   //    /    |    \/
   //  2,8  13,17  24,28
   // left   mid    right
 
+  btree_ptr<> tree;
   int vals[] = {10, 20};
-  shared_ptr<btree> root = build_node(2, vals);
+  btree<> *root = tree.root = build_node(tree, 2, vals, false);
   // now we need three children
   int vals2[] = {2, 8};
-  shared_ptr<btree> left = build_node(2, vals2);
+  btree<> *left = build_node(tree, 2, vals2);
   int vals3[] = {13, 17};
-  shared_ptr<btree> mid = build_node(2, vals3);
+  btree<> *mid = build_node(tree, 2, vals3);
   int vals4[] = {24, 28};
-  shared_ptr<btree> right = build_node(2, vals4);
-  root->is_leaf = false;
-  root->children[0] = left;
-  root->children[1] = mid;
-  root->children[2] = right;
-  return root;
+  btree<> *right = build_node(tree, 2, vals4);
+  root->child(0) = left;
+  root->child(1) = mid;
+  root->child(2) = right;
+  return tree;
 }
 
-shared_ptr<btree> build_two_tier() {
+btree_ptr<> build_two_tier() {
   //        [10,    20,   30]
   //       /     |      \       \/
   //     /       |        \       \/
   // [5,8] [13,15,17,19] [23,27] [33,35,38]
+  btree_ptr<> tree;
   int valsRoot[] = {10, 20, 30};
-  shared_ptr<btree> root = build_node(3, valsRoot);
+  btree<> *root = tree.root = build_node(tree, 3, valsRoot, false);
   int vals1[] = {5, 8};
-  shared_ptr<btree> ch1 = build_node(2, vals1);
+  btree<> *ch1 = build_node(tree, 2, vals1);
   int vals2[] = {13, 15, 17, 19};
-  shared_ptr<btree> ch2 = build_node(4, vals2);
+  btree<> *ch2 = build_node(tree, 4, vals2);
   int vals3[] = {23, 27};
-  shared_ptr<btree> ch3 = build_node(2, vals3);
+  btree<> *ch3 = build_node(tree, 2, vals3);
   int vals4[] = {33, 35, 38};
-  shared_ptr<btree> ch4 = build_node(3, vals4);
-  root->children[0] = ch1;
-  root->children[1] = ch2;
-  root->children[2] = ch3;
-  root->children[3] = ch4;
-  root->is_leaf = false;
+  btree<> *ch4 = build_node(tree, 3, vals4);
+  root->child(0) = ch1;
+  root->child(1) = ch2;
+  root->child(2) = ch3;
+  root->child(3) = ch4;
   root->num_keys = 3;
-  return root;
+  return tree;
 }
 
-shared_ptr<btree> build_full_two_tier() {
+btree_ptr<> build_full_two_tier() {
   //     [4,    7,        13,        20]
   //     /   |       |           |      \/
   //    /    |       |           |       \/
   // [1,3] [5,6] [8,11,12] [14,16,17,18] [23,24,25,26]
+  btree_ptr<> tree;
   int valsRoot[] = {4, 7, 13, 20};
-  shared_ptr<btree> root = build_node(4, valsRoot);
+  btree<> *root = tree.root = build_node(tree, 4, valsRoot, false);
 
   int vals_ch0[] = {1, 3};
-  shared_ptr<btree> ch0 = build_node(2, vals_ch0);
+  btree<> *ch0 = build_node(tree, 2, vals_ch0);
 
   int vals_ch1[] = {5, 6};
-  shared_ptr<btree> ch1 = build_node(2, vals_ch1);
+  btree<> *ch1 = build_node(tree, 2, vals_ch1);
 
   int vals_ch2[] = {8, 11, 12};
-  shared_ptr<btree> ch2 = build_node(3, vals_ch2);
+  btree<> *ch2 = build_node(tree, 3, vals_ch2);
 
   int vals_ch3[] = {14, 16, 17, 18};
-  shared_ptr<btree> ch3 = build_node(4, vals_ch3);
+  btree<> *ch3 = build_node(tree, 4, vals_ch3);
 
   int vals_ch4[] = {23, 24, 25, 26};
-  shared_ptr<btree> ch4 = build_node(4, vals_ch4);
-
-  root->children[0] = ch0;
-  root->children[1] = ch1;
-  root->children[2] = ch2;
-  root->children[3] = ch3;
-  root->children[4] = ch4;
-  root->is_leaf = false;
+  btree<> *ch4 = build_node(tree, 4, vals_ch4);
+
+  root->child(0) = ch0;
+  root->child(1) = ch1;
+  root->child(2) = ch2;
+  root->child(3) = ch3;
+  root->child(4) = ch4;
   root->num_keys = 4;
-  return root;
+  return tree;
 }
 
-shared_ptr<btree> build_thin_three_tier() {
+btree_ptr<> build_thin_three_tier() {
+  btree_ptr<> tree;
   int valsRoot[] = {13};
-  shared_ptr<btree> root = build_node(1, valsRoot);
+  btree<> *root = tree.root = build_node(tree, 1, valsRoot, false);
 
   int vals_ch0[] = {4, 7};
-  shared_ptr<btree> ch0 = build_node(2, vals_ch0);
+  btree<> *ch0 = build_node(tree, 2, vals_ch0, false);
 
   int vals_ch1[] = {17, 24};
-  shared_ptr<btree> ch1 = build_node(2, vals_ch1);
+  btree<> *ch1 = build_node(tree, 2, vals_ch1, false);
 
-  root->is_leaf = false;
-  root->children[0] = ch0;
-  root->children[1] = ch1;
-  ch0->is_leaf = false;
-  ch1->is_leaf = false;
+  root->child(0) = ch0;
+  root->child(1) = ch1;
 
   int leaf_ch0[] = {1, 3};
-  shared_ptr<btree> l0 = build_node(2, leaf_ch0);
+  btree<> *l0 = build_node(tree, 2, leaf_ch0);
 
   int leaf_ch1[] = {5, 6};
-  shared_ptr<btree> l1 = build_node(2, leaf_ch1);
+  btree<> *l1 = build_node(tree, 2, leaf_ch1);
 
   int leaf_ch2[] = {11, 12};
-  shared_ptr<btree> l2 = build_node(2, leaf_ch2);
+  btree<> *l2 = build_node(tree, 2, leaf_ch2);
 
-  ch0->children[0] = l0;
-  ch0->children[1] = l1;
-  ch0->children[2] = l2;
+  ch0->child(0) = l0;
+  ch0->child(1) = l1;
+  ch0->child(2) = l2;
 
   int leaf_r0[] = {14, 16};
-  shared_ptr<btree> r0 = build_node(2, leaf_r0);
+  btree<> *r0 = build_node(tree, 2, leaf_r0);
 
   int leaf_r1[] = {19, 23};
-  shared_ptr<btree> r1 = build_node(2, leaf_r1);
+  btree<> *r1 = build_node(tree, 2, leaf_r1);
 
   int leaf_r2[] = {25, 26};
-  shared_ptr<btree> r2 = build_node(2, leaf_r2);
+  btree<> *r2 = build_node(tree, 2, leaf_r2);
 
-  ch1->children[0] = r0;
-  ch1->children[1] = r1;
-  ch1->children[2] = r2;
+  ch1->child(0) = r0;
+  ch1->child(1) = r1;
+  ch1->child(2) = r2;
 
-  return root;
+  return tree;
 }
 
-shared_ptr<btree> build_node(int size, int *keys) {
-  shared_ptr<btree> node = init_node();
+btree<> *build_node(btree_ptr<> &tree, int size, int *keys, bool is_leaf) {
+  btree<> *node = init_node(tree, is_leaf);
   node->num_keys = size;
   for (int i = 0; i < node->num_keys; i++) {
     node->keys[i] = keys[i];
@@ -190,7 +193,8 @@ shared_ptr<btree> build_node(int size, int *keys) {
   return node;
 }
 
-string get_id_for_dot(shared_ptr<btree> &node) {
+template <typename Node>
+string get_id_for_dot(Node *node) {
   stringstream ss;
   ss << node; // address in memory
   string as_addr = ss.str();
@@ -198,7 +202,8 @@ string get_id_for_dot(shared_ptr<btree> &node) {
   return as_addr;
 }
 
-string get_label_for_dot(shared_ptr<btree> &node) {
+template <typename Node>
+string get_label_for_dot(Node *node) {
 
   stringstream ss;
   for (int i = 0; i < node->num_keys; i++) {
@@ -210,12 +215,14 @@ string get_label_for_dot(shared_ptr<btree> &node) {
   return ss.str();
 }
 
-void print_dot_label(shared_ptr<btree> &node) {
+template <typename Node>
+void print_dot_label(Node *node) {
   cout << "    " << get_id_for_dot(node) << " [label=\""
        << get_label_for_dot(node) << "\"];" << endl;
 }
 
-void print_graphviz_dotfile(shared_ptr<btree> &node, int depth) {
+template <typename Node>
+void print_graphviz_dotfile(Node *node, int depth) {
   string spaces = "    ";
   if (depth == 0) {
     print_dot_label(node);
@@ -224,18 +231,18 @@ void print_graphviz_dotfile(shared_ptr<btree> &node, int depth) {
   string my_id = get_id_for_dot(node);
   for (; idx < node->num_keys; idx++) {
     if (!node->is_leaf) { // don't recurse if this is a leaf.
-      print_dot_label(node->children[idx]);
-      cout << spaces << my_id << " -- " << get_id_for_dot(node->children[idx])
+      print_dot_label(node->child(idx));
+      cout << spaces << my_id << " -- " << get_id_for_dot(node->child(idx))
            << ";" << endl;
-      print_graphviz_dotfile(node->children[idx], depth + 1);
+      print_graphviz_dotfile(node->child(idx), depth + 1);
     }
   }
   // there is always one leftover child, assuming it is not a leaf.
   if (!node->is_leaf) {
-    print_dot_label(node->children[idx]);
-    cout << spaces << my_id << " -- " << get_id_for_dot(node->children[idx])
+    print_dot_label(node->child(idx));
+    cout << spaces << my_id << " -- " << get_id_for_dot(node->child(idx))
          << ";" << endl;
-    print_graphviz_dotfile(node->children[idx], depth + 1);
+    print_graphviz_dotfile(node->child(idx), depth + 1);
   }
 }
 
@@ -244,23 +251,26 @@ void print_graphviz_dotfile(shared_ptr<btree> &node, int depth) {
 // view it.
 //
 // there is a web-based viewer at http://www.webgraphviz.com/
-void print_tree(shared_ptr<btree> &root) {
+template <typename Node>
+void print_tree(Node *root) {
   cout << "graph btree {" << endl;
   int depth = 0;
   print_graphviz_dotfile(root, depth);
   cout << "}" << endl;
 }
 
-bool check_tree(shared_ptr<btree> &root) {
+template <typename Node>
+bool check_tree(Node *root) {
   bool ret = false;
   shared_ptr<invariants> invars = make_shared<invariants>();
-  check_invariants(invars, root, true);
+  check_invariants(invars, root, true, true);
   ret = !any_false(invars);
   return ret;
 }
 
-void check_invariants(shared_ptr<invariants> &invars, shared_ptr<btree> &node,
-                      bool is_root) {
+template <typename Node>
+void check_invariants(shared_ptr<invariants> &invars, Node *node,
+                      bool is_root, bool right_edge) {
 
   if (is_root && node == NULL) {
     invars->ascending = true;
@@ -269,25 +279,28 @@ void check_invariants(shared_ptr<invariants> &invars, shared_ptr<btree> &node,
     invars->good_root = true;
     invars->height_match = true;
     invars->child_key_order = true;
+    invars->leaf_chain = true;
+    invars->summaries = true;
   } else {
     // A node's keys are kept in ascending order, starting at index 0.
     invars->ascending = true;
-    int prev = INT_MIN;
-    for (int i = 0; i < node->num_keys; i++) {
-      if (node->keys[i] <= prev) {
+    for (int i = 1; i < node->num_keys; i++) {
+      if (node->keys[i] <= node->keys[i - 1]) {
         invars->ascending = false;
         break;
       }
     }
 
     // A node may have at most m children.
-    invars->not_fat = node->num_keys < BTREE_ORDER;
+    invars->not_fat = node->num_keys < Node::order;
 
-    // Non-root nodes have at least round_up(m/2) - 1 keys
-    int min_keys = (int)ceil(BTREE_ORDER / 2.0) - 1;
+    // Non-root nodes have at least round_up(m/2) - 1 keys, except on
+    // the right edge, where appends split nodes at the end and leave
+    // the new right node with as few as one key.
+    int min_keys = (int)ceil(Node::order / 2.0) - 1;
     invars->not_starving = is_root;
     if (!is_root) {
-      invars->not_starving = node->num_keys >= min_keys;
+      invars->not_starving = node->num_keys >= (right_edge ? 1 : min_keys);
     }
 
     // If the root is not a leaf, it has at least two children.
@@ -309,15 +322,37 @@ void check_invariants(shared_ptr<invariants> &invars, shared_ptr<btree> &node,
     //  child_key_order = false;
     invars->child_key_order = true;
     if (is_root && !node->is_leaf) {
+      typedef typename Node::key_type key_type;
       invars->child_key_order =
-          check_node_key_range(node, INT_MIN, INT_MAX, true);
+          check_node_key_range(node, numeric_limits<key_type>::min(),
+                               numeric_limits<key_type>::max(), true);
+    }
+
+    // In a B+ tree, following next_leaf from the leftmost leaf visits
+    // every leaf in key order, and prev_leaf leads back the same way.
+    invars->leaf_chain = true;
+    if (is_root) {
+      invars->leaf_chain = check_leaf_chain(node);
+    }
+
+    // In a tree that keeps subtree summaries, each child's summary
+    // matches the keys under it. Checking every node this way checks
+    // the whole tree, since each summary is built from the ones below.
+    invars->summaries = true;
+    if constexpr (Node::is_summarized) {
+      for (int i = 0; !node->is_leaf && i <= node->num_keys; i++) {
+        if (!(node->summary(i) == summarize(node->child(i)))) {
+          invars->summaries = false;
+        }
+      }
     }
 
     if (any_false(invars)) {
       return;
     } else if (!node->is_leaf) {
       for (int i = 0; i <= node->num_keys; i++) {
-        check_invariants(invars, node->children[i], false);
+        check_invariants(invars, node->child(i), false,
+                         right_edge && i == node->num_keys);
         if (any_false(invars)) {
           return;
         }
@@ -326,18 +361,19 @@ void check_invariants(shared_ptr<invariants> &invars, shared_ptr<btree> &node,
   }
 }
 
-void check_leaf_height(shared_ptr<btree> &node, vector<int> &depth,
-                       int current_depth) {
+template <typename Node>
+void check_leaf_height(Node *node, vector<int> &depth, int current_depth) {
   if (node->is_leaf) {
     depth.push_back(current_depth);
   } else {
     for (int i = 0; i <= node->num_keys; i++) {
-      check_leaf_height(node->children[i], depth, current_depth + 1);
+      check_leaf_height(node->child(i), depth, current_depth + 1);
     }
   }
 }
 
-bool check_height(shared_ptr<btree> &node, int &result_height) {
+template <typename Node>
+bool check_height(Node *node, int &result_height) {
   vector<int> depth;
   check_leaf_height(node, depth, 0);
   int val = 0;
@@ -358,7 +394,8 @@ bool check_height(shared_ptr<btree> &node, int &result_height) {
   return same;
 }
 
-void check_size(shared_ptr<btree> &node, int &result_nodes, int &result_keys,
+template <typename Node>
+void check_size(Node *node, int &result_nodes, int &result_keys,
                 bool is_root) {
   if (is_root) {
     result_nodes = 0;
@@ -371,22 +408,59 @@ void check_size(shared_ptr<btree> &node, int &result_nodes, int &result_keys,
   result_keys = result_keys + node->num_keys;
   if (!node->is_leaf) {
     for (int i = 0; i <= node->num_keys; i++) {
-      check_size(node->children[i], result_nodes, result_keys, false);
+      check_size(node->child(i), result_nodes, result_keys, false);
+    }
+  }
+}
+
+template <typename Node>
+void collect_leaves(Node *node, vector<Node *> &leaves) {
+  if (node->is_leaf) {
+    leaves.push_back(node);
+  } else {
+    for (int i = 0; i <= node->num_keys; i++) {
+      collect_leaves(node->child(i), leaves);
+    }
+  }
+}
+
+template <typename Node>
+bool check_leaf_chain(Node *root) {
+  if constexpr (Node::is_bplus) {
+    vector<Node *> leaves;
+    collect_leaves(root, leaves);
+    Node *prev = nullptr;
+    Node *leaf = leaves[0];
+    for (size_t i = 0; i < leaves.size(); i++) {
+      if (leaf != leaves[i] || leaf->prev_leaf() != prev) {
+        return false;
+      }
+      prev = leaf;
+      leaf = leaf->next_leaf();
     }
+    return leaf == nullptr;
+  } else {
+    (void)root;
+    return true;
   }
 }
 
-bool check_node_key_range(shared_ptr<btree> &node, int low, int high,
-                          bool recurse) {
+// In a B+ tree a subtree's low bound is the separator to its left,
+// which may be a copy of the subtree's first key, so keys can equal it.
+template <typename Node>
+bool check_node_key_range(Node *node, typename Node::key_type low,
+                          typename Node::key_type high, bool recurse) {
 
   for (int i = 0; i < node->num_keys; i++) {
-    if (node->keys[i] <= low ||  // key is out of low range
+    bool too_low =
+        Node::is_bplus ? node->keys[i] < low : node->keys[i] <= low;
+    if (too_low ||               // key is out of low range
         node->keys[i] >= high) { // key is out of high range
       return false;
     }
     if (!node->is_leaf && recurse) {
       bool child_result =
-          check_node_key_range(node->children[i], low, node->keys[i], recurse);
+          check_node_key_range(node->child(i), low, node->keys[i], recurse);
       if (!child_result) {
         return false;
       }
@@ -395,7 +469,7 @@ bool check_node_key_range(shared_ptr<btree> &node, int low, int high,
   }
   if (!node->is_leaf && recurse) {
     // need to check that last child is in range too
-    bool child_result = check_node_key_range(node->children[node->num_keys],
+    bool child_result = check_node_key_range(node->child(node->num_keys),
                                              low, high, recurse);
     if (!child_result) {
       return false;
@@ -407,40 +481,279 @@ bool check_node_key_range(shared_ptr<btree> &node, int low, int high,
 bool any_false(shared_ptr<invariants> &invars) {
   bool wrong = invars->ascending && invars->not_fat && invars->not_starving &&
                invars->good_root && invars->height_match &&
-               invars->child_key_order;
+               invars->child_key_order && invars->leaf_chain &&
+               invars->summaries;
 
   return !wrong;
 }
 
-bool private_contains(shared_ptr<btree> &node, int key) {
+template <typename Node>
+bool private_contains(Node *node, typename Node::key_type key) {
   if (node == NULL) {
     return false;
   }
   for (int i = 0; i < node->num_keys; i++) {
-    if (node->keys[i] == key) {
+    if (node->keys[i] == key && Node::is_bplus && !node->is_leaf) {
+      // a B+ tree separator; the key itself is in the leaves to the right
+      return private_contains(node->child(i + 1), key);
+    } else if (node->keys[i] == key) {
       return true;
     } else if (!node->is_leaf && node->keys[i] > key) {
       // if the key is larger than target, answer will be in child i
-      return private_contains(node->children[i], key);
+      return private_contains(node->child(i), key);
     }
   }
   if (!node->is_leaf && node->keys[node->num_keys - 1] < key) {
-    return private_contains(node->children[node->num_keys], key);
+    return private_contains(node->child(node->num_keys), key);
   }
   return false;
 }
 
-bool private_search_all(shared_ptr<btree> &node, int key) {
+template <typename Node>
+bool private_search_all(Node *node, typename Node::key_type key) {
   if (private_contains(node, key)) {
     return true; // found it here!
   }
   if (!node->is_leaf) {
     for (int i = 0; i <= node->num_keys; i++) {
       // search every child, don't pay attention to sort order
-      if (private_search_all(node->children[i], key)) {
+      if (private_search_all(node->child(i), key)) {
         return true;
       }
     }
   }
   return false;
 }
+
+// The btree_ptr overloads check the tree starting at its root node.
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+void print_tree(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree) {
+  print_tree(tree.root);
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool check_tree(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree) {
+  return check_tree(tree.root);
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool check_height(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+                  int &result_height) {
+  return check_height(tree.root, result_height);
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool private_contains(
+    btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree, Key key) {
+  return private_contains(tree.root, key);
+}
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool private_search_all(
+    btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree, Key key) {
+  return private_search_all(tree.root, key);
+}
+
+// child_of returns the i-th child of a concurrent or persistent tree's
+// internal node.
+template <typename Node> Node *child_of(Node *node, int i) {
+  return node->children[i];
+}
+
+template <typename Key, int Order>
+const persistent_node<Key, Order> *
+child_of(const persistent_node<Key, Order> *node, int i) {
+  return node->child(i).get();
+}
+
+// Checks the subtree at node, whose keys must lie in [*low, *high) (a
+// null bound is no bound), adding up its keys and the depth of its
+// leaves.
+template <typename Node>
+bool check_concurrent_node(Node *node, const typename Node::key_type *low,
+                           const typename Node::key_type *high, bool is_root,
+                           int depth, int &leaf_depth, size_t &keys) {
+  if (node->num_keys > Node::max_keys ||
+      (!is_root && node->num_keys < Node::min_keys) ||
+      (is_root && !node->is_leaf && node->num_keys < 1)) {
+    return false;
+  }
+  for (int i = 0; i < node->num_keys; i++) {
+    if ((i > 0 && !(node->keys[i - 1] < node->keys[i])) ||
+        (low != nullptr && node->keys[i] < *low) ||
+        (high != nullptr && !(node->keys[i] < *high))) {
+      return false;
+    }
+  }
+  if (node->is_leaf) {
+    keys += node->num_keys;
+    if (leaf_depth < 0) {
+      leaf_depth = depth;
+    }
+    return leaf_depth == depth;
+  }
+  for (int i = 0; i <= node->num_keys; i++) {
+    const typename Node::key_type *child_low = i > 0 ? &node->keys[i - 1] : low;
+    const typename Node::key_type *child_high =
+        i < node->num_keys ? &node->keys[i] : high;
+    if (!check_concurrent_node(child_of(node, i), child_low, child_high, false,
+                               depth + 1, leaf_depth, keys)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Key, int Order, bool Optimistic>
+bool check_tree(concurrent_btree<Key, Order, Optimistic> &tree) {
+  if (tree.root == nullptr) {
+    return tree.size() == 0;
+  }
+  int leaf_depth = -1;
+  size_t keys = 0;
+  return check_concurrent_node(tree.root.load(), (const Key *)nullptr,
+                               (const Key *)nullptr, true, 0, leaf_depth,
+                               keys) &&
+         keys == tree.size();
+}
+
+template bool check_tree(concurrent_btree<int, 5, false> &);
+template bool check_tree(concurrent_btree<int, 64, false> &);
+template bool check_tree(concurrent_btree<int, 5, true> &);
+template bool check_tree(concurrent_btree<int, 64, true> &);
+
+// Checks the subtree at node as check_concurrent_node does, and that
+// it is the node after last[level] on its level.
+template <typename Node>
+bool check_blink_node(Node *node, const typename Node::key_type *low,
+                      const typename Node::key_type *high,
+                      vector<Node *> &last, size_t &keys) {
+  if (node->num_keys > Node::max_keys ||
+      node->has_high_key != (high != nullptr) ||
+      (high != nullptr && !(node->high_key == *high))) {
+    return false;
+  }
+  if (last[node->level] != nullptr && last[node->level]->right != node) {
+    return false;
+  }
+  last[node->level] = node;
+  for (int i = 0; i < node->num_keys; i++) {
+    if ((i > 0 && !(node->keys[i - 1] < node->keys[i])) ||
+        (low != nullptr && node->keys[i] < *low) ||
+        (high != nullptr && !(node->keys[i] < *high))) {
+      return false;
+    }
+  }
+  if (node->is_leaf) {
+    keys += node->num_keys;
+    return true;
+  }
+  for (int i = 0; i <= node->num_keys; i++) {
+    const typename Node::key_type *child_low = i > 0 ? &node->keys[i - 1] : low;
+    const typename Node::key_type *child_high =
+        i < node->num_keys ? &node->keys[i] : high;
+    Node *child = node->children[i];
+    if (child->level != node->level - 1 ||
+        !check_blink_node(child, child_low, child_high, last, keys)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Key, int Order>
+bool check_tree(blink_btree<Key, Order> &tree) {
+  using Node = blink_node<Key, Order>;
+  Node *root = tree.root.load();
+  if (root == nullptr) {
+    return tree.size() == 0;
+  }
+  vector<Node *> last(root->level + 1, nullptr);
+  size_t keys = 0;
+  if (!check_blink_node(root, (const Key *)nullptr, (const Key *)nullptr, last,
+                        keys)) {
+    return false;
+  }
+  for (Node *node : last) {
+    if (node->right != nullptr) {
+      return false;
+    }
+  }
+  return keys == tree.size();
+}
+
+template bool check_tree(blink_btree<int, 5> &);
+template bool check_tree(blink_btree<int, 64> &);
+
+template <typename Key, int Order>
+bool check_tree(const persistent_btree<Key, Order> &tree) {
+  if (tree.root == nullptr) {
+    return tree.size() == 0;
+  }
+  int leaf_depth = -1;
+  size_t keys = 0;
+  return check_concurrent_node(tree.root.get(), (const Key *)nullptr,
+                               (const Key *)nullptr, true, 0, leaf_depth,
+                               keys) &&
+         keys == tree.size();
+}
+
+template bool check_tree(const persistent_btree<int, 5> &);
+template bool check_tree(const persistent_btree<int, 64> &);
+
+// Instantiate the checking helpers for every order and search policy
+// the tests use, and for the maps in the map tests.
+#define INSTANTIATE_NODE_HELPERS(...)                                          \
+  template void print_tree(__VA_ARGS__ *);                                     \
+  template bool check_tree(__VA_ARGS__ *);                                     \
+  template bool check_height(__VA_ARGS__ *, int &);                            \
+  template void check_size(__VA_ARGS__ *, int &, int &, bool);                 \
+  template bool check_leaf_chain(__VA_ARGS__ *);                               \
+  template bool private_contains(__VA_ARGS__ *, int);                          \
+  template bool private_search_all(__VA_ARGS__ *, int);
+
+#define INSTANTIATE_TREE_HELPERS(...)                                          \
+  template void print_tree(__VA_ARGS__ &);                                     \
+  template bool check_tree(__VA_ARGS__ &);                                     \
+  template bool check_height(__VA_ARGS__ &, int &);                            \
+  template bool private_contains(__VA_ARGS__ &, int);                          \
+  template bool private_search_all(__VA_ARGS__ &, int);
+
+#define INSTANTIATE_TEST_HELPERS_FOR(...)                                      \
+  INSTANTIATE_NODE_HELPERS(btree<int, __VA_ARGS__>)                            \
+  INSTANTIATE_TREE_HELPERS(btree_ptr<int, __VA_ARGS__>)
+
+#define INSTANTIATE_TEST_HELPERS(ORDER)                                        \
+  INSTANTIATE_TEST_HELPERS_FOR(ORDER, sorted_search, void, false)              \
+  INSTANTIATE_TEST_HELPERS_FOR(ORDER, sampled_search<>, void, false)           \
+  INSTANTIATE_TEST_HELPERS_FOR(ORDER, eytzinger_search, void, false)           \
+  INSTANTIATE_TEST_HELPERS_FOR(ORDER, sorted_search, void, true)               \
+  INSTANTIATE_TEST_HELPERS_FOR(ORDER, sorted_search, void, false,              \
+                               subtree_counts)                                 \
+  INSTANTIATE_TEST_HELPERS_FOR(ORDER, sorted_search, void, true, subtree_counts)
+
+TEST_ORDERS(INSTANTIATE_TEST_HELPERS)
+INSTANTIATE_TEST_HELPERS_FOR(5, sorted_search, string, false)
+INSTANTIATE_TEST_HELPERS_FOR(5, sorted_search, string, true)
+INSTANTIATE_TEST_HELPERS_FOR(16, sorted_search, unique_ptr<int>, false)
+INSTANTIATE_TEST_HELPERS_FOR(5, sorted_search, void, false,
+                             monoid_summary<sum_of<long>>)
+INSTANTIATE_TEST_HELPERS_FOR(5, sorted_search, void, true,
+                             monoid_summary<sum_of<long>>)
+INSTANTIATE_TEST_HELPERS_FOR(16, sorted_search, void, false,
+                             monoid_summary<sum_of<long>>)
+INSTANTIATE_TEST_HELPERS_FOR(16, sorted_search, void, true,
+                             monoid_summary<sum_of<long>>)
+INSTANTIATE_TEST_HELPERS_FOR(5, sorted_search, long, false,
+                             monoid_summary<max_of<long>>)
+INSTANTIATE_TEST_HELPERS_FOR(5, sorted_search, long, true,
+                             monoid_summary<max_of<long>>)
+INSTANTIATE_TEST_HELPERS_FOR(16, sorted_search, long, false,
+                             monoid_summary<max_of<long>>)
+INSTANTIATE_TEST_HELPERS_FOR(16, sorted_search, long, true,
+                             monoid_summary<max_of<long>>)
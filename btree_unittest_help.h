@@ -1,4 +1,7 @@
 #include "btree.h"
+#include "btree_blink.h"
+#include "btree_concurrent.h"
+#include "btree_persistent.h"
 #include <memory>
 #include <vector>
 
@@ -27,54 +30,127 @@ struct invariants {
   // holds keys that are larger than the final key.
   bool child_key_order;
 
+  // In a B+ tree, following next_leaf from the leftmost leaf visits
+  // every leaf in key order, and prev_leaf leads back the same way.
+  bool leaf_chain;
+
+  // In a tree that keeps subtree summaries, each child's summary
+  // matches the keys under it.
+  bool summaries;
+
 };
 
-shared_ptr<btree> init_node();
+// The fixtures below are hand-built order 5 trees (btree_ptr<>). The
+// checking helpers are templates, instantiated in
+// btree_unittest_help.cpp for the orders in TEST_ORDERS with each
+// search policy, and as B+ trees and trees with subtree counts.
+#define TEST_ORDERS(X) X(5) X(16) X(64) X(256)
+
+btree<> *init_node(btree_ptr<> &tree, bool is_leaf);
+
+btree_ptr<> build_broken();
 
-shared_ptr<btree> build_broken();
+btree_ptr<> build_semifull();
 
-shared_ptr<btree> build_semifull();
+btree_ptr<> build_empty();
 
-shared_ptr<btree> build_empty();
+btree_ptr<> build_small();
 
-shared_ptr<btree> build_small();
+btree_ptr<> build_full_leaf_root();
 
-shared_ptr<btree> build_full_leaf_root();
+btree_ptr<> build_two_tier();
 
-shared_ptr<btree> build_two_tier();
+btree_ptr<> build_full_two_tier();
 
-shared_ptr<btree> build_full_two_tier();
+btree_ptr<> build_thin_three_tier();
 
-shared_ptr<btree> build_thin_three_tier();
+// build_node allocates a leaf (or, with is_leaf false, an internal
+// node) in 'tree' holding the given keys.
+btree<> *build_node(btree_ptr<> &tree, int size, int *keys,
+                    bool is_leaf = true);
 
-shared_ptr<btree> build_node(int size, int *keys);
+template <typename Node>
+void print_tree(Node *root);
 
-void print_tree(shared_ptr<btree> &root);
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+void print_tree(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree);
 
 // check_tree returns true if all invariants for this b-tree are
 // satisfied, false otherwise.
-bool check_tree(shared_ptr<btree> &root);
+template <typename Node>
+bool check_tree(Node *root);
 
-void check_invariants(shared_ptr<invariants> &invars, shared_ptr<btree> &node,
-                      bool is_root);
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool check_tree(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree);
 
-void check_leaf_height(shared_ptr<btree> &node, vector<int> &depth,
-                       int current_depth);
+// right_edge says node is the last child of a node on the right edge
+// of the tree (or the root).
+template <typename Node>
+void check_invariants(shared_ptr<invariants> &invars, Node *node,
+                      bool is_root, bool right_edge = false);
 
-bool check_height(shared_ptr<btree> &node, int &result_height);
+template <typename Node>
+void check_leaf_height(Node *node, vector<int> &depth, int current_depth);
 
-void check_size(shared_ptr<btree> &node, int &result_nodes, int &result_keys,
+template <typename Node>
+bool check_height(Node *node, int &result_height);
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool check_height(btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree,
+                  int &result_height);
+
+template <typename Node>
+void check_size(Node *node, int &result_nodes, int &result_keys,
                 bool is_root);
 
-bool check_node_key_range(shared_ptr<btree> &node, int low, int high,
-                          bool recurse);
+// check_leaf_chain returns true if the leaf chain of the B+ tree at
+// root links up the leaves in the order the tree holds them.
+template <typename Node>
+bool check_leaf_chain(Node *root);
+
+template <typename Node>
+bool check_node_key_range(Node *node, typename Node::key_type low,
+                          typename Node::key_type high, bool recurse);
 
 bool any_false(shared_ptr<invariants> &invars);
 
-shared_ptr<btree> load_tree_from_file(string &filename);
+btree_ptr<> load_tree_from_file(string &filename);
+
+template <typename Node>
+bool private_contains(Node *node, typename Node::key_type key);
 
-bool private_contains(shared_ptr<btree> &node, int key);
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool private_contains(
+    btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree, Key key);
 
 // private_search_all looks at every node in the tree for the given
 // key and returns true when it finds it, or false if it doesn't.
-bool private_search_all(shared_ptr<btree> &node, int key);
+template <typename Node>
+bool private_search_all(Node *node, typename Node::key_type key);
+
+template <typename Key, int Order, typename Search, typename Value,
+          bool BPlus, typename Summary>
+bool private_search_all(
+    btree_ptr<Key, Order, Search, Value, BPlus, Summary> &tree, Key key);
+
+// check_tree for a concurrent_btree checks the B+ tree invariants and
+// that size() matches the keys in the leaves. It takes no latches, so
+// no other thread may be using the tree.
+template <typename Key, int Order, bool Optimistic>
+bool check_tree(concurrent_btree<Key, Order, Optimistic> &tree);
+
+// check_tree for a blink_btree checks that keys are in order and below
+// each node's high key, that the high keys match the separators in the
+// parents, that the right links string each level together in order,
+// and that size() matches the keys in the leaves. Nodes may have any
+// number of keys up to max_keys. It takes no latches either.
+template <typename Key, int Order> bool check_tree(blink_btree<Key, Order> &tree);
+
+// check_tree for a persistent_btree checks the B+ tree invariants and
+// that size() matches the keys in the leaves.
+template <typename Key, int Order>
+bool check_tree(const persistent_btree<Key, Order> &tree);